@@ -0,0 +1,15 @@
+################################################################################
+# SPDX-License-Identifier: LGPL-3.0-only
+#
+# This file is part of hed.
+################################################################################
+
+include ../common.mk
+
+bins                   := hed-repo-bench
+hed-repo-bench-objs    := repo.o
+hed-repo-bench-cflags  := $(common-cflags)
+hed-repo-bench-ldflags := -L$(BUILDDIR)/../lib -l:libhed.a $(common-ldflags)
+hed-repo-bench-pkgconf := $(common-pkgconf) libutils
+
+# ex: filetype=make :
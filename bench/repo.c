@@ -0,0 +1,928 @@
+/******************************************************************************
+ * SPDX-License-Identifier: LGPL-3.0-only
+ *
+ * This file is part of hed.
+ ******************************************************************************/
+
+#include "hed/repo.h"
+#include <getopt.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_TBL         "bench"
+#define BENCH_DUP_TBL     "bench-dup"
+/* Values per key of the duplicate table, sized like Ethernet addresses. */
+#define BENCH_DUP_NR      8U
+#define BENCH_DUP_SIZE    6U
+#define BENCH_BATCH       1000U
+#define BENCH_MANY        64U
+#define BENCH_COMMIT_NR   1000U
+#define BENCH_SAMPLE_MAX  1000000U
+#define BENCH_COUNT_MIN   1000UL
+#define BENCH_SIZE_NR     8U
+
+/*
+ * Latency recorder. Keeps at most BENCH_SAMPLE_MAX evenly spread samples so
+ * that runs over 1e7 keys remain affordable.
+ */
+struct bench_lat {
+	uint32_t *ns;
+	size_t    nr;
+	size_t    every;
+	size_t    cnt;
+};
+
+struct bench_run {
+	const char      *name;
+	size_t           ops;
+	double           secs;
+	struct bench_lat lat;
+};
+
+struct bench_conf {
+	const char *dir;
+	size_t      count_max;
+	size_t      ksize[BENCH_SIZE_NR];
+	size_t      ksize_nr;
+	size_t      vsize[BENCH_SIZE_NR];
+	size_t      vsize_nr;
+	bool        nosync;
+	FILE       *out;
+};
+
+struct bench_ctx {
+	const struct bench_conf *conf;
+	struct hed_repo          repo;
+	char                    *path;
+	unsigned int             tbl;
+	unsigned int             dup;
+	size_t                   count;
+	size_t                   ksize;
+	size_t                   vsize;
+	uint8_t                 *key;
+	uint8_t                 *value;
+	size_t                  *order;
+	bool                     first;
+};
+
+static const struct hed_repo_tbl_desc bench_tables[] = {
+	{ .name = BENCH_TBL },
+#if !defined(CONFIG_HED_REPO_3PC)
+	{
+		.name  = BENCH_DUP_TBL,
+		.flags = HED_REPO_TBL_DUPSORT | HED_REPO_TBL_DUPFIXED
+	}
+#endif
+};
+
+static uint64_t
+bench_nsec(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return ((uint64_t)now.tv_sec * 1000000000ULL) + (uint64_t)now.tv_nsec;
+}
+
+static int
+bench_lat_init(struct bench_lat * lat, size_t ops)
+{
+	lat->every = (ops + BENCH_SAMPLE_MAX - 1) / BENCH_SAMPLE_MAX;
+	if (!lat->every)
+		lat->every = 1;
+
+	lat->ns = malloc(((ops / lat->every) + 1) * sizeof(lat->ns[0]));
+	if (!lat->ns)
+		return -ENOMEM;
+
+	lat->nr = 0;
+	lat->cnt = 0;
+
+	return 0;
+}
+
+static void
+bench_lat_add(struct bench_lat * lat, uint64_t ns)
+{
+	if (!(lat->cnt++ % lat->every))
+		lat->ns[lat->nr++] = (uint32_t)stroll_min(ns, (uint64_t)UINT32_MAX);
+}
+
+static int
+bench_lat_cmp(const void * first, const void * second)
+{
+	uint32_t a = *(const uint32_t *)first;
+	uint32_t b = *(const uint32_t *)second;
+
+	return (a > b) - (a < b);
+}
+
+static uint32_t
+bench_lat_pct(const struct bench_lat * lat, unsigned int permil)
+{
+	if (!lat->nr)
+		return 0;
+
+	return lat->ns[((lat->nr - 1) * permil) / 1000];
+}
+
+/* Deterministic xorshift so that runs may be compared with each other. */
+static uint64_t
+bench_rand(uint64_t * state)
+{
+	uint64_t x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	*state = x;
+
+	return x;
+}
+
+/* Keys are big-endian indices, padded to the key size. */
+static void
+bench_make_key(const struct bench_ctx * ctx, size_t index)
+{
+	uint64_t idx = (uint64_t)index;
+	size_t len = stroll_min(ctx->ksize, sizeof(idx));
+	size_t i;
+
+	memset(ctx->key, 0, ctx->ksize);
+	for (i = 0; i < len; i++)
+		ctx->key[len - 1 - i] = (uint8_t)(idx >> (8 * i));
+}
+
+static void
+bench_report(struct bench_ctx * ctx, struct bench_run * run)
+{
+	FILE *out = ctx->conf->out;
+
+	qsort(run->lat.ns, run->lat.nr, sizeof(run->lat.ns[0]), bench_lat_cmp);
+
+	fprintf(out,
+	        "%s\n    {\"case\": \"%s\", \"3pc\": %s, \"keys\": %zu, "
+	        "\"ksize\": %zu, \"vsize\": %zu, \"ops\": %zu, "
+	        "\"secs\": %.6f, \"ops_per_sec\": %.1f, "
+	        "\"lat_ns\": {\"p50\": %" PRIu32 ", \"p90\": %" PRIu32 ", "
+	        "\"p99\": %" PRIu32 ", \"p999\": %" PRIu32 ", "
+	        "\"max\": %" PRIu32 "}}",
+	        ctx->first ? "" : ",",
+	        run->name,
+#if defined(CONFIG_HED_REPO_3PC)
+	        "true",
+#else
+	        "false",
+#endif
+	        ctx->count,
+	        ctx->ksize,
+	        ctx->vsize,
+	        run->ops,
+	        run->secs,
+	        run->secs > 0 ? (double)run->ops / run->secs : 0.0,
+	        bench_lat_pct(&run->lat, 500),
+	        bench_lat_pct(&run->lat, 900),
+	        bench_lat_pct(&run->lat, 990),
+	        bench_lat_pct(&run->lat, 999),
+	        run->lat.nr ? run->lat.ns[run->lat.nr - 1] : 0);
+
+	ctx->first = false;
+	free(run->lat.ns);
+}
+
+static int
+bench_begin(struct bench_run * run, const char * name, size_t ops)
+{
+	run->name = name;
+	run->ops = ops;
+	run->secs = 0;
+
+	return bench_lat_init(&run->lat, ops);
+}
+
+/* Timed operation wrapper: accounts latency and total elapsed time. */
+#define BENCH_OP(_run, _expr) \
+	({ \
+		uint64_t __start = bench_nsec(); \
+		int      __ret = (_expr); \
+		uint64_t __ns = bench_nsec() - __start; \
+		\
+		bench_lat_add(&(_run)->lat, __ns); \
+		(_run)->secs += (double)__ns / 1e9; \
+		__ret; \
+	 })
+
+/* Commit a batch, accounting commit cost to the running case. */
+static int
+bench_commit(struct bench_ctx * ctx, struct bench_run * run)
+{
+	uint64_t start = bench_nsec();
+	int ret;
+
+	ret = hed_repo_commit(&ctx->repo);
+	run->secs += (double)(bench_nsec() - start) / 1e9;
+
+	return ret;
+}
+
+static int
+bench_update(struct bench_ctx * ctx)
+{
+	struct bench_run run;
+	size_t i;
+	int ret;
+
+	ret = bench_begin(&run, "update", ctx->count);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < ctx->count; i++) {
+		if (!(i % BENCH_BATCH)) {
+			if (i) {
+				ret = bench_commit(ctx, &run);
+				if (ret)
+					goto free;
+			}
+
+			ret = hed_repo_start(&ctx->repo);
+			if (ret)
+				goto free;
+		}
+
+		bench_make_key(ctx, ctx->order[i]);
+		memcpy(ctx->value, ctx->key, stroll_min(ctx->ksize,
+		                                        ctx->vsize));
+		ret = BENCH_OP(&run,
+		               hed_repo_tbl_update(&ctx->repo, ctx->tbl,
+		                                   ctx->key, ctx->ksize,
+		                                   ctx->value, ctx->vsize));
+		if (ret)
+			goto abort;
+	}
+
+	ret = bench_commit(ctx, &run);
+	if (ret)
+		goto free;
+
+	bench_report(ctx, &run);
+
+	return 0;
+
+abort:
+	hed_repo_abort(&ctx->repo);
+free:
+	free(run.lat.ns);
+	return ret;
+}
+
+static int
+bench_get(struct bench_ctx * ctx, bool by_name)
+{
+	struct bench_run run;
+	uint8_t *value;
+	size_t vlen;
+	size_t i;
+	int ret;
+
+	ret = bench_begin(&run, by_name ? "get_by_name" : "get", ctx->count);
+	if (ret)
+		return ret;
+
+	ret = hed_repo_start(&ctx->repo);
+	if (ret)
+		goto free;
+
+	for (i = 0; i < ctx->count; i++) {
+		bench_make_key(ctx, ctx->order[ctx->count - 1 - i]);
+		if (by_name)
+			ret = BENCH_OP(&run,
+			               hed_repo_get(&ctx->repo, BENCH_TBL,
+			                            ctx->key, ctx->ksize,
+			                            &value, &vlen));
+		else
+			ret = BENCH_OP(&run,
+			               hed_repo_tbl_get(&ctx->repo, ctx->tbl,
+			                                ctx->key, ctx->ksize,
+			                                &value, &vlen));
+		if (ret)
+			break;
+	}
+
+	hed_repo_abort(&ctx->repo);
+	if (ret)
+		goto free;
+
+	bench_report(ctx, &run);
+
+	return 0;
+
+free:
+	free(run.lat.ns);
+	return ret;
+}
+
+static int
+bench_get_many(struct bench_ctx * ctx)
+{
+	struct hed_repo_item item[BENCH_MANY];
+	struct bench_run run;
+	uint8_t *keys;
+	size_t i;
+	size_t n;
+	int ret;
+
+	keys = malloc(BENCH_MANY * ctx->ksize);
+	if (!keys)
+		return -ENOMEM;
+
+	ret = bench_begin(&run, "get_many", ctx->count);
+	if (ret)
+		goto free_keys;
+
+	ret = hed_repo_start(&ctx->repo);
+	if (ret)
+		goto free;
+
+	/* Latencies are those of whole batches. */
+	for (i = 0; i < ctx->count; i += n) {
+		n = stroll_min((size_t)BENCH_MANY, ctx->count - i);
+		for (size_t k = 0; k < n; k++) {
+			bench_make_key(ctx, ctx->order[ctx->count - 1 - i - k]);
+			memcpy(&keys[k * ctx->ksize], ctx->key, ctx->ksize);
+			item[k].key = &keys[k * ctx->ksize];
+			item[k].klen = ctx->ksize;
+		}
+
+		ret = BENCH_OP(&run,
+		               hed_repo_tbl_get_many(&ctx->repo, ctx->tbl,
+		                                     item, n));
+		if (ret)
+			break;
+	}
+
+	hed_repo_abort(&ctx->repo);
+	if (ret)
+		goto free;
+
+	bench_report(ctx, &run);
+	free(keys);
+
+	return 0;
+
+free:
+	free(run.lat.ns);
+free_keys:
+	free(keys);
+	return ret;
+}
+
+static int
+bench_step(struct bench_ctx * ctx)
+{
+	struct hed_repo_iter iter;
+	struct bench_run run;
+	uint8_t *key;
+	size_t klen;
+	uint8_t *value;
+	size_t vlen;
+	int ret;
+
+	ret = bench_begin(&run, "step", ctx->count);
+	if (ret)
+		return ret;
+
+	ret = hed_repo_start(&ctx->repo);
+	if (ret)
+		goto free;
+
+	hed_repo_iter_init(&iter);
+	ret = hed_repo_tbl_iter_range(&iter, &ctx->repo, ctx->tbl,
+	                              NULL, 0, NULL, 0, 0);
+	if (!ret) {
+		do {
+			ret = BENCH_OP(&run,
+			               hed_repo_step(&iter, &key, &klen,
+			                             &value, &vlen));
+		} while (ret == EAGAIN);
+	}
+
+	hed_repo_iter_fini(&iter);
+	hed_repo_abort(&ctx->repo);
+	if (ret)
+		goto free;
+
+	bench_report(ctx, &run);
+
+	return 0;
+
+free:
+	free(run.lat.ns);
+	return ret;
+}
+
+#if !defined(CONFIG_HED_REPO_3PC)
+
+/*
+ * Walk values of keys carrying several ones, which DUPFIXED tables pack into
+ * sub-pages, checking that each key yields all of its values.
+ */
+static int
+bench_step_dup(struct bench_ctx * ctx)
+{
+	size_t nr = ctx->count / BENCH_DUP_NR;
+	uint8_t value[BENCH_DUP_SIZE] = { 0 };
+	struct hed_repo_iter iter;
+	struct bench_run run;
+	uint8_t *val;
+	size_t vlen;
+	size_t i;
+	size_t d;
+	int ret;
+
+	ret = bench_begin(&run, "step_dup", nr * BENCH_DUP_NR);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < nr; i++) {
+		if (!(i % BENCH_BATCH)) {
+			if (i) {
+				ret = hed_repo_commit(&ctx->repo);
+				if (ret)
+					goto free;
+			}
+
+			ret = hed_repo_start(&ctx->repo);
+			if (ret)
+				goto free;
+		}
+
+		bench_make_key(ctx, i);
+		for (d = 0; d < BENCH_DUP_NR; d++) {
+			value[BENCH_DUP_SIZE - 1] = (uint8_t)d;
+			ret = hed_repo_tbl_update(&ctx->repo, ctx->dup,
+			                          ctx->key, ctx->ksize,
+			                          value, sizeof(value));
+			if (ret)
+				goto abort;
+		}
+	}
+
+	ret = hed_repo_commit(&ctx->repo);
+	if (ret)
+		goto free;
+
+	ret = hed_repo_start(&ctx->repo);
+	if (ret)
+		goto free;
+
+	for (i = 0; i < nr; i++) {
+		bench_make_key(ctx, ctx->order[i] % nr);
+
+		hed_repo_iter_init(&iter);
+		ret = hed_repo_tbl_iter_dup(&iter, &ctx->repo, ctx->dup,
+		                            ctx->key, ctx->ksize, 0);
+		d = 0;
+		if (!ret) {
+			do {
+				ret = BENCH_OP(&run,
+				               hed_repo_step(&iter, NULL, NULL,
+				                             &val, &vlen));
+				if (ret < 0)
+					break;
+				if ((vlen != sizeof(value)) ||
+				    (val[BENCH_DUP_SIZE - 1] != d)) {
+					ret = -EBADMSG;
+					break;
+				}
+				d++;
+			} while (ret == EAGAIN);
+		}
+		hed_repo_iter_fini(&iter);
+
+		if (!ret && (d != BENCH_DUP_NR))
+			ret = -EBADMSG;
+		if (ret)
+			goto abort;
+	}
+
+	hed_repo_abort(&ctx->repo);
+
+	bench_report(ctx, &run);
+
+	return 0;
+
+abort:
+	hed_repo_abort(&ctx->repo);
+free:
+	free(run.lat.ns);
+	return ret;
+}
+
+#endif /* !defined(CONFIG_HED_REPO_3PC) */
+
+static int
+bench_next_seq(struct bench_ctx * ctx)
+{
+	struct bench_run run;
+	size_t i;
+	int ret;
+
+	ret = bench_begin(&run, "next_seq", ctx->count);
+	if (ret)
+		return ret;
+
+	/* Outside of transactions: blocks are reserved in their own. */
+	for (i = 0; i < ctx->count; i++) {
+		ret = BENCH_OP(&run,
+		               !hed_repo_tbl_next_seq(&ctx->repo, ctx->tbl));
+		if (ret) {
+			ret = -ENOSPC;
+			goto free;
+		}
+	}
+
+	bench_report(ctx, &run);
+
+	return 0;
+
+free:
+	free(run.lat.ns);
+	return ret;
+}
+
+static int
+bench_commit_cost(struct bench_ctx * ctx)
+{
+	struct bench_run run;
+	size_t i;
+	int ret;
+
+	ret = bench_begin(&run, "commit", BENCH_COMMIT_NR);
+	if (ret)
+		return ret;
+
+	/* Single update transactions: latencies are those of commits. */
+	for (i = 0; i < BENCH_COMMIT_NR; i++) {
+		ret = hed_repo_start(&ctx->repo);
+		if (ret)
+			goto free;
+
+		bench_make_key(ctx, ctx->order[i % ctx->count]);
+		ret = hed_repo_tbl_update(&ctx->repo, ctx->tbl,
+		                          ctx->key, ctx->ksize,
+		                          ctx->value, ctx->vsize);
+		if (ret) {
+			hed_repo_abort(&ctx->repo);
+			goto free;
+		}
+
+		ret = BENCH_OP(&run, hed_repo_commit(&ctx->repo));
+		if (ret)
+			goto free;
+	}
+
+	bench_report(ctx, &run);
+
+	return 0;
+
+free:
+	free(run.lat.ns);
+	return ret;
+}
+
+static int
+bench_del(struct bench_ctx * ctx)
+{
+	struct bench_run run;
+	size_t i;
+	int ret;
+
+	ret = bench_begin(&run, "del", ctx->count);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < ctx->count; i++) {
+		if (!(i % BENCH_BATCH)) {
+			if (i) {
+				ret = bench_commit(ctx, &run);
+				if (ret)
+					goto free;
+			}
+
+			ret = hed_repo_start(&ctx->repo);
+			if (ret)
+				goto free;
+		}
+
+		bench_make_key(ctx, ctx->order[i]);
+		ret = BENCH_OP(&run,
+		               hed_repo_tbl_del(&ctx->repo, ctx->tbl,
+		                                ctx->key, ctx->ksize));
+		if (ret)
+			goto abort;
+	}
+
+	ret = bench_commit(ctx, &run);
+	if (ret)
+		goto free;
+
+	bench_report(ctx, &run);
+
+	return 0;
+
+abort:
+	hed_repo_abort(&ctx->repo);
+free:
+	free(run.lat.ns);
+	return ret;
+}
+
+static void
+bench_unlink(const struct bench_ctx * ctx)
+{
+	size_t len = strlen(ctx->path);
+	char lock[len + sizeof("-lock")];
+
+	memcpy(lock, ctx->path, len);
+	memcpy(&lock[len], "-lock", sizeof("-lock"));
+
+	unlink(ctx->path);
+	unlink(lock);
+}
+
+static int
+bench_run(struct bench_ctx * ctx)
+{
+	struct hed_repo_conf conf = {
+		.map_size    = 64UL << 20,
+		.map_max     = 1UL << 40,
+		.max_readers = 0,
+		.durability  = ctx->conf->nosync ? HED_REPO_NOSYNC :
+		                                   HED_REPO_SYNC,
+		.writemap    = false,
+		.sync_period = 0,
+		.feed_size   = 0
+	};
+	uint64_t rnd = 0x9e3779b97f4a7c15ULL;
+	size_t i;
+	int ret;
+
+	/* Random insertion order, also used to look keys up. */
+	for (i = 0; i < ctx->count; i++)
+		ctx->order[i] = i;
+	for (i = ctx->count - 1; i > 0; i--) {
+		size_t j = (size_t)(bench_rand(&rnd) % (i + 1));
+		size_t tmp = ctx->order[i];
+
+		ctx->order[i] = ctx->order[j];
+		ctx->order[j] = tmp;
+	}
+
+	memset(ctx->value, 0xa5, ctx->vsize);
+	bench_unlink(ctx);
+
+	ret = hed_repo_open_desc(&ctx->repo, ctx->path, bench_tables,
+	                         stroll_array_nr(bench_tables),
+	                         O_RDWR | O_CREAT | O_TRUNC, 0600, &conf);
+	if (ret)
+		return ret;
+
+	ctx->tbl = (unsigned int)hed_repo_tbl_index(&ctx->repo, BENCH_TBL);
+#if !defined(CONFIG_HED_REPO_3PC)
+	ctx->dup = (unsigned int)hed_repo_tbl_index(&ctx->repo, BENCH_DUP_TBL);
+#endif
+
+	ret = bench_update(ctx);
+	if (!ret)
+		ret = bench_get(ctx, false);
+	if (!ret)
+		ret = bench_get(ctx, true);
+	if (!ret)
+		ret = bench_get_many(ctx);
+	if (!ret)
+		ret = bench_step(ctx);
+#if !defined(CONFIG_HED_REPO_3PC)
+	if (!ret)
+		ret = bench_step_dup(ctx);
+#endif
+	if (!ret)
+		ret = bench_next_seq(ctx);
+	if (!ret)
+		ret = bench_commit_cost(ctx);
+	if (!ret)
+		ret = bench_del(ctx);
+
+	hed_repo_close(&ctx->repo);
+	bench_unlink(ctx);
+
+	return ret;
+}
+
+static size_t
+bench_parse_sizes(char * arg, size_t * sizes)
+{
+	char *tok;
+	char *save;
+	size_t nr = 0;
+
+	for (tok = strtok_r(arg, ",", &save);
+	     tok && (nr < BENCH_SIZE_NR);
+	     tok = strtok_r(NULL, ",", &save)) {
+		sizes[nr++] = (size_t)strtoul(tok, NULL, 0);
+	}
+
+	return nr;
+}
+
+/* Smallest key size holding indices of up to `count' keys without clashing. */
+static size_t
+bench_key_min(size_t count)
+{
+	uint64_t last = (uint64_t)count - 1;
+	size_t bytes = 1;
+
+	while ((bytes < sizeof(last)) && (last >> (8 * bytes)))
+		bytes++;
+
+	return bytes;
+}
+
+static void
+bench_usage(FILE * stdio, const char * me)
+{
+	fprintf(stdio,
+	        "Usage: %s [OPTIONS]\n"
+	        "Benchmark hed repo operations, reporting results as JSON.\n"
+	        "\n"
+	        "With OPTIONS:\n"
+	        "    -d|--dir DIR       create databases into DIR [/tmp]\n"
+	        "    -n|--count MAX     run with 1e3, 1e4... up to MAX keys "
+	        "[100000]\n"
+	        "    -k|--ksize SIZES   comma separated key sizes [8,32]\n"
+	        "    -v|--vsize SIZES   comma separated value sizes "
+	        "[16,256]\n"
+	        "    -s|--nosync        do not sync commits to disk\n"
+	        "    -o|--output FILE   write results to FILE [stdout]\n"
+	        "    -h|--help          this help message\n",
+	        me);
+}
+
+int
+main(int argc, char * const argv[])
+{
+	static const struct option opts[] = {
+		{ "dir",    required_argument, NULL, 'd' },
+		{ "count",  required_argument, NULL, 'n' },
+		{ "ksize",  required_argument, NULL, 'k' },
+		{ "vsize",  required_argument, NULL, 'v' },
+		{ "nosync", no_argument,       NULL, 's' },
+		{ "output", required_argument, NULL, 'o' },
+		{ "help",   no_argument,       NULL, 'h' },
+		{ NULL,     0,                 NULL, 0 }
+	};
+	struct bench_conf conf = {
+		.dir       = "/tmp",
+		.count_max = 100000,
+		.ksize     = { 8, 32 },
+		.ksize_nr  = 2,
+		.vsize     = { 16, 256 },
+		.vsize_nr  = 2,
+		.nosync    = false,
+		.out       = stdout
+	};
+	struct bench_ctx ctx = { .conf = &conf, .first = true };
+	size_t k;
+	size_t v;
+	int ret = EXIT_FAILURE;
+
+	while (true) {
+		int opt = getopt_long(argc, argv, "d:n:k:v:so:h", opts, NULL);
+
+		if (opt < 0)
+			break;
+
+		switch (opt) {
+		case 'd':
+			conf.dir = optarg;
+			break;
+
+		case 'n':
+			conf.count_max = (size_t)strtoul(optarg, NULL, 0);
+			break;
+
+		case 'k':
+			conf.ksize_nr = bench_parse_sizes(optarg, conf.ksize);
+			break;
+
+		case 'v':
+			conf.vsize_nr = bench_parse_sizes(optarg, conf.vsize);
+			break;
+
+		case 's':
+			conf.nosync = true;
+			break;
+
+		case 'o':
+			conf.out = fopen(optarg, "w");
+			if (!conf.out) {
+				perror(optarg);
+				return EXIT_FAILURE;
+			}
+			break;
+
+		case 'h':
+			bench_usage(stdout, argv[0]);
+			return EXIT_SUCCESS;
+
+		default:
+			bench_usage(stderr, argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if ((conf.count_max < BENCH_COUNT_MIN) || !conf.ksize_nr ||
+	    !conf.vsize_nr) {
+		bench_usage(stderr, argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	for (k = 0; k < conf.ksize_nr; k++) {
+		if (conf.ksize[k] < bench_key_min(conf.count_max)) {
+			fprintf(stderr,
+			        "%zu: key size too small for %zu keys\n",
+			        conf.ksize[k], conf.count_max);
+			return EXIT_FAILURE;
+		}
+		if (conf.ksize[k] > HED_REPO_KEY_MAX) {
+			fprintf(stderr, "%zu: key size too large\n",
+			        conf.ksize[k]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	for (v = 0; v < conf.vsize_nr; v++) {
+		if (!conf.vsize[v]) {
+			fprintf(stderr, "value size must not be zero\n");
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (asprintf(&ctx.path, "%s/hed-repo-bench.mdb", conf.dir) < 0)
+		return EXIT_FAILURE;
+
+	ctx.order = malloc(conf.count_max * sizeof(ctx.order[0]));
+	if (!ctx.order)
+		goto free_path;
+
+	fprintf(conf.out, "{\n  \"results\": [");
+
+	for (ctx.count = BENCH_COUNT_MIN;
+	     ctx.count <= conf.count_max;
+	     ctx.count *= 10) {
+		for (k = 0; k < conf.ksize_nr; k++) {
+			for (v = 0; v < conf.vsize_nr; v++) {
+				ctx.ksize = conf.ksize[k];
+				ctx.vsize = conf.vsize[v];
+				ctx.key = malloc(ctx.ksize);
+				ctx.value = malloc(ctx.vsize);
+				if (!ctx.key || !ctx.value) {
+					free(ctx.key);
+					free(ctx.value);
+					goto free_order;
+				}
+
+				ret = bench_run(&ctx);
+
+				free(ctx.key);
+				free(ctx.value);
+
+				if (ret) {
+					fprintf(stderr,
+					        "%zu keys: run failed: %s (%d)\n",
+					        ctx.count,
+					        ret < 0 ? strerror(-ret) :
+					                  mdb_strerror(ret),
+					        ret);
+					ret = EXIT_FAILURE;
+					goto free_order;
+				}
+			}
+		}
+	}
+
+	ret = EXIT_SUCCESS;
+
+free_order:
+	fprintf(conf.out, "\n  ]\n}\n");
+	free(ctx.order);
+free_path:
+	free(ctx.path);
+	if (conf.out != stdout)
+		fclose(conf.out);
+
+	return ret;
+}
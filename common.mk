@@ -14,6 +14,7 @@ common-cflags         := -Wall \
                          -Wcast-align \
                          -Wmissing-declarations \
                          -D_GNU_SOURCE \
+                         -pthread \
                          -iquote $(TOPDIR)/include \
                          -I $(TOPDIR)/include \
                          $(EXTRA_CFLAGS)
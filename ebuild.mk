@@ -18,8 +18,11 @@ headers         += $(call kconf_enabled,HED_TROER_BASE,hed/base.h)
 headers         += $(call kconf_enabled,HED_TROER_BASE,hed/base.yml)
 headers         += $(call kconf_enabled,HED_TROER_INET,hed/inet.h)
 headers         += $(call kconf_enabled,HED_TROER_INET,hed/inet.yml)
+headers         += $(call kconf_enabled,HED_TROER,hed/repo_troer.h)
 
 subdirs         := lib
+subdirs         += $(call kconf_enabled,HED_BENCH,bench)
+bench-deps      := lib
 
 define libhed_pkgconf_tmpl
 prefix=$(PREFIX)
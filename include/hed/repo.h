@@ -8,27 +8,482 @@
 #define _HED_REPO_H
 
 #include <hed/cdefs.h>
+#include <dpack/codec.h>
 #include <errno.h>
 #include <fcntl.h>
 #include <lmdb.h>
+#include <pthread.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stroll/lvstr.h>
+#include <time.h>
 #include <utils/file.h>
+#include <utils/timer.h>
+
+struct hed_repo_snap;
+
+/* Trade-off between write throughput and durability on system crash. */
+enum hed_repo_durability {
+	/* Sync data and meta pages on each commit. */
+	HED_REPO_SYNC,
+	/* Omit meta page sync: may lose the last transaction. */
+	HED_REPO_NOMETASYNC,
+	/* Writable mapping flushed asynchronously: may lose last transactions. */
+	HED_REPO_MAPASYNC,
+	/* No sync at all: may lose last transactions or corrupt the repo. */
+	HED_REPO_NOSYNC
+};
+
+/*
+ * Largest key LMDB accepts with its default build configuration, less the
+ * 16-bit table index the undo journal prefixes keys with.
+ */
+#if defined(CONFIG_HED_REPO_3PC)
+#define HED_REPO_KEY_MAX 509
+#else
+#define HED_REPO_KEY_MAX 511
+#endif
+
+/*
+ * Repo environment tuning. Zeroed fields select LMDB defaults. When not zero,
+ * sync_period is the interval in milliseconds at which relaxed durability
+ * modes are explicitly synced, driven by the etux timers. A non zero map_max
+ * lets the map grow geometrically from map_size up to map_max bytes whenever
+ * it runs full (see struct hed_repo_log). A non zero feed_size enables the
+ * change feed with a ring of feed_size bytes (see struct hed_repo_feed).
+ */
+struct hed_repo_conf {
+	size_t                    map_size;
+	size_t                    map_max;
+	unsigned int              max_readers;
+	enum hed_repo_durability  durability;
+	bool                      writemap;
+	int                       sync_period;
+	size_t                    feed_size;
+};
+
+/* In-memory block of reserved sequence numbers: [next, last]. */
+struct hed_repo_seq {
+	uint32_t next;
+	uint32_t last;
+	bool     pending;
+};
+
+/*
+ * Replay log of the current write transaction. When map growth is enabled,
+ * every write is recorded here so that a transaction failing with
+ * MDB_MAP_FULL may be aborted, the map enlarged and the transaction replayed
+ * transparently. Growth is given up while iterators are open on the write
+ * transaction since their cursors would not survive the replay, and while
+ * snapshots are in use: the transaction is then left intact and the write fails
+ * with MDB_MAP_FULL. Should the replay itself fail, `lost' is set and every
+ * operation but aborting fails with MDB_BAD_TXN.
+ */
+struct hed_repo_log {
+	uint8_t      *data;
+	size_t        used;
+	size_t        capa;
+	unsigned int  cursor_nr;
+	bool          on;
+	bool          lost;
+};
+
+enum hed_repo_feed_op {
+	HED_REPO_FEED_PUT,
+	HED_REPO_FEED_DEL,
+	/* Changes were lost: subscribers must rescan tables. */
+	HED_REPO_FEED_OVERFLOW
+};
+
+/*
+ * Change feed. Keys modified by a write transaction are collected into a
+ * pending buffer, then published into a bounded ring once the transaction
+ * commits and the eventfd `fd' is signaled. When the ring is full, oldest
+ * changes are dropped: subscribers lagging behind get a
+ * HED_REPO_FEED_OVERFLOW marker instead of ever stalling commits.
+ * Ring positions are absolute byte offsets in the stream of changes.
+ */
+struct hed_repo_feed {
+	pthread_mutex_t  lock;
+	uint8_t         *ring;
+	size_t           size;
+	uint64_t         head;
+	uint64_t         tail;
+	uint64_t         commit;
+	int              fd;
+	uint8_t         *pend;
+	size_t           used;
+	size_t           capa;
+	bool             lost;
+};
+
+/* Change feed subscriber, holding its ring position. */
+struct hed_repo_sub {
+	struct hed_repo *repo;
+	uint64_t         pos;
+	uint8_t          key[HED_REPO_KEY_MAX];
+};
+
+/*
+ * A change read from the feed. `key' points to the subscriber storage and
+ * is valid until the next read. `commit' numbers committed transactions.
+ */
+struct hed_repo_change {
+	uint64_t               commit;
+	unsigned int           tbl;
+	enum hed_repo_feed_op  op;
+	const uint8_t         *key;
+	size_t                 klen;
+};
+
+/*
+ * Decode a table value into an object of the cache object size. Objects are
+ * copied bytewise in and out of the cache: they must not own memory.
+ */
+typedef int (hed_repo_decode_fn)(const uint8_t * data,
+                                 size_t size,
+                                 void * object);
+
+struct hed_repo_cache_stats {
+	uint64_t hit;
+	uint64_t miss;
+	uint64_t evict;
+	uint64_t inval;
+	size_t   used;
+	size_t   nr;
+};
+
+struct hed_repo_cache;
+
+#define HED_REPO_LAT_NR 24U
+
+/*
+ * Activity counters. Bucket i of the commit latency histogram counts commits
+ * that took less than 2^i microseconds, the last one counting all slower
+ * commits. Hold times measure write transactions from start to end, in
+ * microseconds.
+ */
+struct hed_repo_counters {
+	uint64_t get;
+	uint64_t put;
+	uint64_t del;
+	uint64_t commit;
+	uint64_t abort;
+	uint64_t commit_lat[HED_REPO_LAT_NR];
+	uint64_t hold_sum;
+	uint64_t hold_max;
+};
+
+/*
+ * Table options given by struct hed_repo_tbl_desc to hed_repo_open_desc():
+ * - HED_REPO_TBL_INTKEY: keys are native unsigned int or size_t integers,
+ *   e.g. hed_repo_next_seq() identifiers, compared numerically;
+ * - HED_REPO_TBL_DUPSORT: a key may carry multiple values, sorted. Updates
+ *   add a value to the key, deletions drop all of them unless given one;
+ * - HED_REPO_TBL_DUPFIXED: duplicate values all have the same size, which
+ *   stores them packed and allows hed_repo_step_multiple() bulk reads;
+ * - HED_REPO_TBL_INTDUP: fixed size duplicates are native integers;
+ * - HED_REPO_TBL_TTL: entries may be given an expiry deadline (see
+ *   hed_repo_expire()).
+ * Duplicate tables do not support in place reservation nor decoded object
+ * caching, and are not available along with CONFIG_HED_REPO_3PC.
+ *
+ * A table described with an `extract' callback is a secondary index of table
+ * `primary': for every primary entry the callback gives a key for, the index
+ * table maps this key to the primary key. Indexes are maintained by the
+ * primary table updates, deletions, reservations and bulk loads, within the
+ * same transaction; a failure to do so leaves the transaction in an undefined
+ * state: it must be aborted. Index tables must be HED_REPO_TBL_DUPSORT and are
+ * not written to directly. Primary tables may not be duplicate tables nor
+ * indexes. Opening a repo fills in empty indexes of non empty primary tables.
+ */
+#define HED_REPO_TBL_INTKEY   (1U << 0)
+#define HED_REPO_TBL_DUPSORT  (1U << 1)
+#define HED_REPO_TBL_DUPFIXED (1U << 2)
+#define HED_REPO_TBL_INTDUP   (1U << 3)
+
+#define HED_REPO_TBL_TTL      (1U << 4)
+
+#define HED_REPO_TBL_DUP \
+	(HED_REPO_TBL_DUPSORT | HED_REPO_TBL_DUPFIXED | HED_REPO_TBL_INTDUP)
+
+/*
+ * Entry expiry. Deadlines of HED_REPO_TBL_TTL table entries are kept, with a
+ * millisecond resolution, in an internal table ordered by deadline so that
+ * hed_repo_expire() deletes entries whose deadline has passed, earliest first,
+ * at a cost proportional to their count. Deleting an entry drops its deadline
+ * while updating it keeps it. Deadlines are CLOCK_REALTIME based so that they
+ * survive restarts; they are not part of dumps.
+ * TTL tables may not be duplicate tables nor indexes, and their keys are
+ * limited to HED_REPO_TTL_KEY_MAX bytes.
+ */
+#define HED_REPO_TTL_KEY_MAX \
+	(HED_REPO_KEY_MAX - (1U + sizeof(uint64_t) + sizeof(uint16_t)))
+
+/*
+ * Extract the secondary index key of a primary table entry into `ikey', which
+ * has room for HED_REPO_KEY_MAX bytes. Return the key length, 0 to leave the
+ * entry out of the index, or a negative errno-like code on failure.
+ */
+typedef ssize_t (hed_repo_extract_fn)(const uint8_t * key,
+                                      size_t klen,
+                                      const uint8_t * value,
+                                      size_t vlen,
+                                      uint8_t * ikey);
+
+struct hed_repo_tbl_desc {
+	const char          *name;
+	unsigned int         flags;
+	hed_repo_extract_fn *extract;
+	unsigned int         primary;
+};
+
+/*
+ * Savepoint, in caller storage: a nested write transaction started within the
+ * current one by hed_repo_save_begin(). hed_repo_save_commit() merges its
+ * changes into the enclosing transaction while hed_repo_save_abort() drops
+ * them alone. Savepoints nest; the innermost one must be ended first and all
+ * of them before the write transaction. Iterators positioned within a
+ * savepoint must be stopped before it ends. Not available with writemap nor
+ * HED_REPO_MAPASYNC durability.
+ */
+struct hed_repo_save {
+	struct hed_repo_save *prev;
+	MDB_txn              *parent;
+	size_t                log_mark;
+	size_t                feed_mark;
+	bool                  feed_lost;
+	unsigned int          seq_pending;
+};
 
 struct hed_repo {
-	MDB_env             *env;
-	MDB_txn             *txn;
-	struct stroll_lvstr  path;
-	struct stroll_lvstr  backup;
-	const int            flags;
-	const mode_t         mode;
-	const char  * const *table;
-	const size_t         nb;
+	MDB_env              *env;
+	MDB_txn              *txn;
+	MDB_dbi              *dbi;
+	struct stroll_lvstr   path;
+	const int             flags;
+	const mode_t          mode;
+	const char  * const  *table;
+	const size_t          nb;
+	struct hed_repo_seq  *seq;
+	unsigned int          seq_pending;
+	pthread_mutex_t       snap_lock;
+	pthread_cond_t        snap_cond;
+	struct hed_repo_snap *snap_pool;
+	unsigned int          snap_nr;
+	unsigned int          copy_nr;
+	struct hed_repo_conf  conf;
+	struct etux_timer     sync_timer;
+	struct hed_repo_log   log;
+	unsigned int          grow_nr;
+	struct hed_repo_feed  feed;
+	struct hed_repo_cache **cache;
+	struct hed_repo_counters cnt;
+	struct timespec       txn_start;
+	bool                  timed;
+#if defined(CONFIG_HED_REPO_3PC)
+	bool                  undo;
+#endif
+	struct hed_repo_save *save;
+	const struct hed_repo_tbl_desc *desc;
+	unsigned int          index_nr;
+	unsigned int          ttl_nr;
+	uint16_t             *ttl_id;
+};
+
+/* Table statistics: page counts and bytes these pages span. */
+struct hed_repo_tbl_stats {
+	size_t       entries;
+	unsigned int depth;
+	size_t       branch_pages;
+	size_t       leaf_pages;
+	size_t       overflow_pages;
+	size_t       bytes;
+};
+
+/*
+ * Environment statistics: sizes in bytes unless stated otherwise. readers
+ * counts read transactions live at sampling time, across all processes.
+ */
+struct hed_repo_stats {
+	size_t                   map_size;
+	size_t                   map_used;
+	size_t                   page_size;
+	size_t                   last_txnid;
+	unsigned int             readers;
+	unsigned int             max_readers;
+	size_t                   free_pages;
+	struct hed_repo_counters cnt;
 };
 
+/* Map geometry: current size and bytes used, both in bytes. */
+struct hed_repo_map_info {
+	size_t       size;
+	size_t       used;
+	unsigned int grow_nr;
+};
+
+/*
+ * Read-only snapshot of a repo. Snapshots may be used from any thread, and
+ * concurrently with the repo write transaction. Their underlying LMDB read
+ * transactions are pooled and recycled across hed_repo_read_begin() /
+ * hed_repo_read_end() calls.
+ * Heap iterators created from a snapshot must be destroyed before ending it.
+ */
+struct hed_repo_snap {
+	MDB_txn              *txn;
+	struct hed_repo      *repo;
+	struct hed_repo_snap *next;
+};
+
+/*
+ * Tables are addressed by their index into the `table' array given to
+ * hed_repo_open(). The ".hed" meta table is always located right after user
+ * tables.
+ */
+#define HED_REPO_META_TBL(_repo) \
+	((unsigned int)(_repo)->nb)
+
+/* Walk keys in descending order. */
+#define HED_REPO_ITER_REVERSE (1U << 0)
+
 struct hed_repo_iter {
 	MDB_cursor *cursor;
 	struct hed_repo *repo;
+	MDB_cursor_op step;
+	unsigned int flags;
+	const uint8_t *bound;
+	size_t blen;
+	bool renew;
+	MDB_dbi primary;
+};
+
+/*
+ * Value space reserved right into a table page by hed_repo_tbl_reserve().
+ * The value is serialized in place through `encoder' then sealed using
+ * hed_repo_reserve_end(), which must happen before any other operation on the
+ * repo. The key given at reservation time must remain valid until then.
+ * Reserving the exact encoded size spares any copy. A larger reservation is
+ * shrunk at sealing time: the encoded value is copied into a heap buffer then
+ * stored again, i.e. an allocation and two copies. Sealing an empty encoding
+ * deletes the entry and fails with -ENODATA. When map growth is enabled, every
+ * sealed value is also copied into the replay log, once more when shrunk.
+ */
+struct hed_repo_resv {
+	struct dpack_encoder  encoder;
+	struct hed_repo      *repo;
+	unsigned int          tbl;
+	MDB_val               idx;
+	uint8_t              *data;
+	size_t                size;
+	size_t                loff;
+};
+
+/*
+ * Item of a hed_repo_get_many() batch lookup. Callers fill in key and klen;
+ * value and vlen are filled in on return, status holding 0 when found,
+ * MDB_NOTFOUND, or any other LMDB error met while looking the key up. The
+ * batch lookup then fails with the first error other than MDB_NOTFOUND.
+ */
+struct hed_repo_item {
+	const uint8_t *key;
+	size_t         klen;
+	uint8_t       *value;
+	size_t         vlen;
+	int            status;
+};
+
+/*
+ * Online compaction. hed_repo_compact_start() copies the repo with
+ * MDB_CP_COMPACT from a background thread, working on a read snapshot so
+ * that writes keep flowing meanwhile. A write transaction needing to grow the
+ * map waits for the copy to complete. hed_repo_compact_end() waits for the
+ * copy then swaps it in, which must happen at a quiescent point: outside of
+ * any transaction and snapshot. Should a write have committed since the copy
+ * started, the copy is stale: it is taken again while holding writers off
+ * with a write transaction, so that none may be lost. Once swapped, sizes are
+ * reported even if a later step fails. Should reopening the repo fail, it is
+ * released as if closed and -ENOTRECOVERABLE is returned.
+ */
+struct hed_repo_compact {
+	struct hed_repo *repo;
+	pthread_t        thread;
+	char            *path;
+	size_t           txnid;
+	int              status;
+};
+
+/* Compaction outcome: file sizes in bytes and freelist sizes in pages. */
+struct hed_repo_compact_info {
+	size_t size_before;
+	size_t size_after;
+	size_t free_before;
+	size_t free_after;
+};
+
+/*
+ * Table dumps. hed_repo_export() streams a table, or all of them including the
+ * repo metadata when given HED_REPO_TBL_ALL, to a file descriptor as a sequence
+ * of records made of a 32-bit big-endian length followed by a msgpack payload.
+ * It runs within the current write transaction if any, within a read snapshot
+ * otherwise. hed_repo_import() loads a dump using the bulk loader, appending
+ * entries in dump order and committing them in batches: batches committed
+ * before a failure are kept. Tables are matched by name and must exist;
+ * existing keys are overwritten, except sequence high-water marks which only
+ * ever rise. Dumped secondary indexes are skipped since loading their primary
+ * table maintains them. Records are limited to CONFIG_HED_REPO_DUMP_REC_MAX
+ * mebibytes: exporting a larger entry fails with -EMSGSIZE, importing a larger
+ * record with -EBADMSG.
+ * The optional progress callback is given the table at hand, the count of
+ * entries and bytes of dump processed so far every buffer worth of dump. Its
+ * non zero return value cancels the operation and is returned.
+ */
+#define HED_REPO_TBL_ALL (~0U)
+
+typedef int (hed_repo_progress_fn)(const char * table,
+                                   size_t nr,
+                                   size_t bytes,
+                                   void * data);
+
+/*
+ * Parallel table scan. hed_repo_scan() splits the table key space into ranges
+ * walked concurrently by nr workers, the caller thread included, each from its
+ * own read transaction. All transactions share the same snapshot of the last
+ * committed state.
+ * The callback runs for every entry from worker threads and is given the
+ * index of the worker calling it, so that results may be accumulated per
+ * worker without locking, then merged once scan is over. Entries are given in
+ * key order within a range, in no particular order across ranges. Its non
+ * zero return value stops the scan and is returned.
+ */
+typedef int (hed_repo_scan_fn)(unsigned int worker,
+                               const uint8_t * key,
+                               size_t klen,
+                               const uint8_t * value,
+                               size_t vlen,
+                               void * data);
+
+/* Buffer and sort entries given to hed_repo_bulk_add() before loading them. */
+#define HED_REPO_BULK_SORT (1U << 0)
+
+struct hed_repo_bulk_ent;
+
+/*
+ * Bulk loader state. Entries are appended to the table end with MDB_APPEND
+ * and committed every `batch' entries. Unless HED_REPO_BULK_SORT is given,
+ * entries are expected in key order: out of order keys are still inserted,
+ * only slower.
+ */
+struct hed_repo_bulk {
+	struct hed_repo          *repo;
+	unsigned int              tbl;
+	unsigned int              flags;
+	size_t                    batch;
+	size_t                    nr;
+	struct hed_repo_bulk_ent *ent;
+	uint8_t                  *data;
+	size_t                    used;
+	size_t                    capa;
 };
 
 extern int
@@ -40,14 +495,181 @@ hed_repo_open(struct hed_repo    *repo,
               mode_t              mode)
 	__hed_nonull(1, 2) __warn_result;
 
-extern void
+extern int
+hed_repo_open_conf(struct hed_repo             *repo,
+                   const char                  *path,
+                   const char * const          *table,
+                   size_t                       nb,
+                   int                          flags,
+                   mode_t                       mode,
+                   const struct hed_repo_conf  *conf)
+	__hed_nonull(1, 2) __warn_result;
+
+extern int
+hed_repo_open_desc(struct hed_repo                *repo,
+                   const char                     *path,
+                   const struct hed_repo_tbl_desc *desc,
+                   size_t                          nb,
+                   int                             flags,
+                   mode_t                          mode,
+                   const struct hed_repo_conf     *conf)
+	__hed_nonull(1, 2) __warn_result;
+
+/*
+ * Closing and reloading fail with -EBUSY, leaving the repo untouched, while
+ * snapshots, scans or compactions are still running.
+ */
+extern int
 hed_repo_close(struct hed_repo * repo)
 	__hed_nonull(1);
 
+static inline bool __hed_nonull(1) __warn_result
+hed_repo_tbl_dup(const struct hed_repo * repo, unsigned int tbl)
+{
+	hed_assert_api(repo);
+	hed_assert_api(tbl <= HED_REPO_META_TBL(repo));
+
+	return repo->desc && (tbl < repo->nb) &&
+	       (repo->desc[tbl].flags & HED_REPO_TBL_DUP);
+}
+
+static inline bool __hed_nonull(1) __warn_result
+hed_repo_tbl_intkey(const struct hed_repo * repo, unsigned int tbl)
+{
+	hed_assert_api(repo);
+	hed_assert_api(tbl <= HED_REPO_META_TBL(repo));
+
+	return repo->desc && (tbl < repo->nb) &&
+	       (repo->desc[tbl].flags & HED_REPO_TBL_INTKEY);
+}
+
+static inline bool __hed_nonull(1) __warn_result
+hed_repo_tbl_ttl(const struct hed_repo * repo, unsigned int tbl)
+{
+	hed_assert_api(repo);
+	hed_assert_api(tbl <= HED_REPO_META_TBL(repo));
+
+	return repo->desc && (tbl < repo->nb) &&
+	       (repo->desc[tbl].flags & HED_REPO_TBL_TTL);
+}
+
+static inline bool __hed_nonull(1) __warn_result
+hed_repo_tbl_secondary(const struct hed_repo * repo, unsigned int tbl)
+{
+	hed_assert_api(repo);
+	hed_assert_api(tbl <= HED_REPO_META_TBL(repo));
+
+	return repo->desc && (tbl < repo->nb) && repo->desc[tbl].extract;
+}
+
 extern int
 hed_repo_reload(struct hed_repo * repo)
 	__hed_nonull(1) __warn_result;
 
+extern int
+hed_repo_get_map_info(struct hed_repo * repo,
+                      struct hed_repo_map_info * info)
+	__hed_nonull(1, 2) __warn_result;
+
+/*
+ * Decoded object cache of a table, sized to `budget' bytes with CLOCK
+ * eviction. Keys modified by the write transaction are invalidated when it
+ * commits and bypass the cache until then; aborting restores them.
+ * The cache serves reads performed through the repo own transaction only.
+ */
+extern int
+hed_repo_cache_enable(struct hed_repo * repo,
+                      unsigned int tbl,
+                      size_t obj_size,
+                      hed_repo_decode_fn * decode,
+                      size_t budget)
+	__hed_nonull(1, 4) __warn_result;
+
+extern void
+hed_repo_cache_disable(struct hed_repo * repo, unsigned int tbl)
+	__hed_nonull(1);
+
+extern int
+hed_repo_cache_get(struct hed_repo * repo,
+                   unsigned int tbl,
+                   const uint8_t * key,
+                   size_t klen,
+                   void * object)
+	__hed_nonull(1, 3, 5) __warn_result;
+
+extern void
+hed_repo_cache_stats(const struct hed_repo * repo,
+                     unsigned int tbl,
+                     struct hed_repo_cache_stats * stats)
+	__hed_nonull(1, 3);
+
+extern int
+hed_repo_get_stats(struct hed_repo * repo, struct hed_repo_stats * stats)
+	__hed_nonull(1, 2) __warn_result;
+
+extern int
+hed_repo_get_tbl_stats(struct hed_repo * repo,
+                       unsigned int tbl,
+                       struct hed_repo_tbl_stats * stats)
+	__hed_nonull(1, 3) __warn_result;
+
+extern void
+hed_repo_reset_counters(struct hed_repo * repo)
+	__hed_nonull(1);
+
+extern int
+hed_repo_compact_start(struct hed_repo_compact * cpt, struct hed_repo * repo)
+	__hed_nonull(1, 2) __warn_result;
+
+extern int
+hed_repo_compact_end(struct hed_repo_compact * cpt,
+                     struct hed_repo_compact_info * info)
+	__hed_nonull(1) __warn_result;
+
+extern int
+hed_repo_export(struct hed_repo * repo,
+                unsigned int tbl,
+                int fd,
+                hed_repo_progress_fn * progress,
+                void * data)
+	__hed_nonull(1) __warn_result;
+
+extern int
+hed_repo_import(struct hed_repo * repo,
+                int fd,
+                hed_repo_progress_fn * progress,
+                void * data)
+	__hed_nonull(1) __warn_result;
+
+extern int
+hed_repo_scan(struct hed_repo * repo,
+              unsigned int tbl,
+              unsigned int nr,
+              hed_repo_scan_fn * fn,
+              void * data)
+	__hed_nonull(1, 4) __warn_result;
+
+extern void
+hed_repo_sub_init(struct hed_repo_sub * sub, struct hed_repo * repo)
+	__hed_nonull(1, 2);
+
+extern int
+hed_repo_feed_read(struct hed_repo_sub * sub, struct hed_repo_change * chg)
+	__hed_nonull(1, 2) __warn_result;
+
+extern void
+hed_repo_feed_clear(struct hed_repo * repo)
+	__hed_nonull(1);
+
+static inline int __hed_nonull(1) __warn_result
+hed_repo_feed_fd(const struct hed_repo * repo)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->feed.ring);
+
+	return repo->feed.fd;
+}
+
 extern int
 hed_repo_start(struct hed_repo * repo)
 	__hed_nonull(1) __warn_result;
@@ -57,6 +679,12 @@ hed_repo_commit(struct hed_repo * repo)
 	__hed_nonull(1) __warn_result;
 
 #if defined(CONFIG_HED_REPO_3PC)
+/*
+ * Revert the last write transaction started by hed_repo_start() once
+ * committed. This is a no-op when the last write transaction was aborted,
+ * failed to commit or was rolled back already, as well as when it was an
+ * internal one (such as an own sequence reservation).
+ */
 extern int
 hed_repo_rollback(struct hed_repo * repo)
 	__hed_nonull(1) __warn_result;
@@ -66,6 +694,18 @@ extern void
 hed_repo_abort(struct hed_repo * repo)
 	__hed_nonull(1);
 
+extern int
+hed_repo_save_begin(struct hed_repo * repo, struct hed_repo_save * save)
+	__hed_nonull(1, 2) __warn_result;
+
+extern int
+hed_repo_save_commit(struct hed_repo * repo)
+	__hed_nonull(1) __warn_result;
+
+extern void
+hed_repo_save_abort(struct hed_repo * repo)
+	__hed_nonull(1);
+
 extern int
 hed_repo_get(struct hed_repo * repo,
              const char * table,
@@ -75,6 +715,13 @@ hed_repo_get(struct hed_repo * repo,
              size_t * vlen)
 	__hed_nonull(1, 2, 3, 5, 6) __warn_result;
 
+extern int
+hed_repo_get_many(struct hed_repo * repo,
+                  const char * table,
+                  struct hed_repo_item * items,
+                  size_t nr)
+	__hed_nonull(1, 2, 3) __warn_result;
+
 extern int
 hed_repo_update(struct hed_repo * repo,
                 const char * table,
@@ -84,6 +731,19 @@ hed_repo_update(struct hed_repo * repo,
                 size_t vlen)
 	__hed_nonull(1, 2, 3, 5) __warn_result;
 
+extern int
+hed_repo_reserve(struct hed_repo_resv * resv,
+                 struct hed_repo * repo,
+                 const char * table,
+                 const uint8_t * key,
+                 size_t klen,
+                 size_t vlen)
+	__hed_nonull(1, 2, 3, 4) __warn_result;
+
+extern int
+hed_repo_reserve_end(struct hed_repo_resv * resv)
+	__hed_nonull(1) __warn_result;
+
 extern int
 hed_repo_del(struct hed_repo * repo,
                 const char * table,
@@ -91,6 +751,13 @@ hed_repo_del(struct hed_repo * repo,
                 size_t klen)
 	__hed_nonull(1, 2, 3) __warn_result;
 
+/*
+ * Counting functions (hed_repo_count(), hed_repo_tbl_count(),
+ * hed_repo_tbl_count_dup(), hed_repo_snap_count() and hed_repo_expire())
+ * return a negative value on failure: either an LMDB MDB_* error code as is or
+ * a negated errno value, those returned by LMDB included. hed_repo_count()
+ * fails with MDB_NOTFOUND for unknown tables.
+ */
 extern ssize_t
 hed_repo_count(struct hed_repo * repo,
                const char * table)
@@ -106,6 +773,79 @@ hed_repo_create_iter(struct hed_repo * repo,
                      const char * table)
 	__hed_nonull(1, 2) __warn_result;
 
+/*
+ * Iterate over keys within [lo, hi[, in ascending or descending order. A NULL
+ * bound leaves the range open on that side. Bounds must remain valid until the
+ * iterator is destroyed.
+ */
+extern struct hed_repo_iter *
+hed_repo_tbl_create_range_iter(struct hed_repo * repo,
+                               unsigned int tbl,
+                               const uint8_t * lo,
+                               size_t llen,
+                               const uint8_t * hi,
+                               size_t hlen,
+                               unsigned int flags)
+	__hed_nonull(1) __warn_result;
+
+/*
+ * Iterate over keys starting with prefix. Prefix must remain valid until the
+ * iterator is destroyed.
+ */
+extern struct hed_repo_iter *
+hed_repo_tbl_create_prefix_iter(struct hed_repo * repo,
+                                unsigned int tbl,
+                                const uint8_t * prefix,
+                                size_t plen,
+                                unsigned int flags)
+	__hed_nonull(1, 3) __warn_result;
+
+/*
+ * Iterators may also live in caller storage, avoiding allocation and, for
+ * snapshot iterators, cursor setup: an initialized iterator is (re)positioned
+ * with the hed_repo_*_iter_range() / hed_repo_*_iter_prefix() calls, which
+ * return MDB_NOTFOUND when range is empty.
+ * Iterators positioned within the write transaction must be stopped before
+ * transaction ends. Snapshot iterators keep their cursor across snapshots for
+ * renewal until hed_repo_iter_fini() is called.
+ */
+static inline void __hed_nonull(1)
+hed_repo_iter_init(struct hed_repo_iter * iter)
+{
+	hed_assert_api(iter);
+
+	iter->cursor = NULL;
+	iter->renew = false;
+}
+
+extern int
+hed_repo_tbl_iter_range(struct hed_repo_iter * iter,
+                        struct hed_repo * repo,
+                        unsigned int tbl,
+                        const uint8_t * lo,
+                        size_t llen,
+                        const uint8_t * hi,
+                        size_t hlen,
+                        unsigned int flags)
+	__hed_nonull(1, 2) __warn_result;
+
+extern int
+hed_repo_tbl_iter_prefix(struct hed_repo_iter * iter,
+                         struct hed_repo * repo,
+                         unsigned int tbl,
+                         const uint8_t * prefix,
+                         size_t plen,
+                         unsigned int flags)
+	__hed_nonull(1, 2, 4) __warn_result;
+
+extern void
+hed_repo_iter_stop(struct hed_repo_iter * iter)
+	__hed_nonull(1);
+
+extern void
+hed_repo_iter_fini(struct hed_repo_iter * iter)
+	__hed_nonull(1);
+
 extern void
 hed_repo_destroy_iter(struct hed_repo_iter *iter)
 	__hed_nonull(1);
@@ -118,6 +858,296 @@ hed_repo_step(struct hed_repo_iter * iter,
               size_t * vlen)
 	__hed_nonull(1) __warn_result;
 
+extern int
+hed_repo_tbl_index(const struct hed_repo * repo,
+                   const char * table)
+	__hed_nonull(1, 2) __warn_result;
+
+extern int
+hed_repo_tbl_get(struct hed_repo * repo,
+                 unsigned int tbl,
+                 const uint8_t * key,
+                 size_t klen,
+                 uint8_t * * const value,
+                 size_t * vlen)
+	__hed_nonull(1, 3, 5, 6) __warn_result;
+
+extern int
+hed_repo_tbl_get_many(struct hed_repo * repo,
+                      unsigned int tbl,
+                      struct hed_repo_item * items,
+                      size_t nr)
+	__hed_nonull(1, 3) __warn_result;
+
+extern int
+hed_repo_tbl_update(struct hed_repo * repo,
+                    unsigned int tbl,
+                    const uint8_t * key,
+                    size_t klen,
+                    const uint8_t * value,
+                    size_t vlen)
+	__hed_nonull(1, 3, 5) __warn_result;
+
+extern int
+hed_repo_tbl_reserve(struct hed_repo_resv * resv,
+                     struct hed_repo * repo,
+                     unsigned int tbl,
+                     const uint8_t * key,
+                     size_t klen,
+                     size_t vlen)
+	__hed_nonull(1, 2, 4) __warn_result;
+
+extern int
+hed_repo_tbl_del(struct hed_repo * repo,
+                 unsigned int tbl,
+                 const uint8_t * key,
+                 size_t klen)
+	__hed_nonull(1, 3) __warn_result;
+
+/*
+ * Duplicate tables: hed_repo_tbl_get_dup() tells whether a key carries the
+ * given value, returning 0 if so, MDB_NOTFOUND otherwise.
+ * hed_repo_tbl_del_dup() deletes this value alone. hed_repo_tbl_count_dup()
+ * counts values of a key.
+ * hed_repo_tbl_iter_dup() positions an iterator onto the values of a key for
+ * hed_repo_step() to walk, or, for fixed size duplicates, for
+ * hed_repo_step_multiple() to fetch in page sized chunks: `size' bytes of
+ * packed values are returned at each call, which returns 0 as long as some
+ * were found, MDB_NOTFOUND afterwards. Both step calls must not be mixed on
+ * the same iterator.
+ */
+extern int
+hed_repo_tbl_get_dup(struct hed_repo * repo,
+                     unsigned int tbl,
+                     const uint8_t * key,
+                     size_t klen,
+                     const uint8_t * value,
+                     size_t vlen)
+	__hed_nonull(1, 3, 5) __warn_result;
+
+extern int
+hed_repo_tbl_del_dup(struct hed_repo * repo,
+                     unsigned int tbl,
+                     const uint8_t * key,
+                     size_t klen,
+                     const uint8_t * value,
+                     size_t vlen)
+	__hed_nonull(1, 3, 5) __warn_result;
+
+extern ssize_t
+hed_repo_tbl_count_dup(struct hed_repo * repo,
+                       unsigned int tbl,
+                       const uint8_t * key,
+                       size_t klen)
+	__hed_nonull(1, 3) __warn_result;
+
+extern int
+hed_repo_tbl_iter_dup(struct hed_repo_iter * iter,
+                      struct hed_repo * repo,
+                      unsigned int tbl,
+                      const uint8_t * key,
+                      size_t klen,
+                      unsigned int flags)
+	__hed_nonull(1, 2, 4) __warn_result;
+
+extern int
+hed_repo_step_multiple(struct hed_repo_iter * iter,
+                       uint8_t * * const values,
+                       size_t * size)
+	__hed_nonull(1, 2, 3) __warn_result;
+
+/*
+ * Secondary index lookups. hed_repo_tbl_get_secondary() returns the first
+ * primary entry an index key maps to, MDB_NOTFOUND if none.
+ * Positioned onto an index key by hed_repo_tbl_iter_dup(), an iterator walks
+ * the primary entries this key maps to with hed_repo_step_secondary(), which
+ * returns just like hed_repo_step() and may skip fetching values.
+ */
+extern int
+hed_repo_tbl_get_secondary(struct hed_repo * repo,
+                           unsigned int tbl,
+                           const uint8_t * ikey,
+                           size_t iklen,
+                           uint8_t * * const key,
+                           size_t * klen,
+                           uint8_t * * const value,
+                           size_t * vlen)
+	__hed_nonull(1, 3, 5, 6) __warn_result;
+
+extern int
+hed_repo_step_secondary(struct hed_repo_iter * iter,
+                        uint8_t * * const key,
+                        size_t * klen,
+                        uint8_t * * const value,
+                        size_t * vlen)
+	__hed_nonull(1, 2, 3) __warn_result;
+
+/*
+ * hed_repo_tbl_set_deadline() sets the expiry deadline of an existing entry,
+ * or clears it when given NULL, returning MDB_NOTFOUND when the entry does not
+ * exist. hed_repo_tbl_set_ttl() sets it `msec' milliseconds from now.
+ * hed_repo_tbl_get_deadline() returns MDB_NOTFOUND when an entry has none.
+ * hed_repo_expire() deletes at most `nr' entries whose deadline is not later
+ * than `now', within the write transaction, and returns their count: a count
+ * of `nr' tells that more entries may have expired. Failures follow the
+ * counting functions convention.
+ */
+extern int
+hed_repo_tbl_set_deadline(struct hed_repo * repo,
+                          unsigned int tbl,
+                          const uint8_t * key,
+                          size_t klen,
+                          const struct timespec * deadline)
+	__hed_nonull(1, 3) __warn_result;
+
+static inline int __hed_nonull(1, 3) __warn_result
+hed_repo_tbl_set_ttl(struct hed_repo * repo,
+                     unsigned int tbl,
+                     const uint8_t * key,
+                     size_t klen,
+                     unsigned int msec)
+{
+	hed_assert_api(repo);
+
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += (time_t)(msec / 1000U);
+	deadline.tv_nsec += (long)(msec % 1000U) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	return hed_repo_tbl_set_deadline(repo, tbl, key, klen, &deadline);
+}
+
+extern int
+hed_repo_tbl_get_deadline(struct hed_repo * repo,
+                          unsigned int tbl,
+                          const uint8_t * key,
+                          size_t klen,
+                          struct timespec * deadline)
+	__hed_nonull(1, 3, 5) __warn_result;
+
+extern ssize_t
+hed_repo_expire(struct hed_repo * repo,
+                const struct timespec * now,
+                unsigned int nr)
+	__hed_nonull(1, 2) __warn_result;
+
+extern ssize_t
+hed_repo_tbl_count(struct hed_repo * repo,
+                   unsigned int tbl)
+	__hed_nonull(1) __warn_result;
+
+extern uint32_t
+hed_repo_tbl_next_seq(struct hed_repo * repo,
+                      unsigned int tbl)
+	__hed_nonull(1) __warn_result;
+
+extern struct hed_repo_iter *
+hed_repo_tbl_create_iter(struct hed_repo * repo,
+                         unsigned int tbl)
+	__hed_nonull(1) __warn_result;
+
+extern int
+hed_repo_read_begin(struct hed_repo * repo,
+                    struct hed_repo_snap * * snap)
+	__hed_nonull(1, 2) __warn_result;
+
+extern void
+hed_repo_read_end(struct hed_repo_snap * snap)
+	__hed_nonull(1);
+
+extern int
+hed_repo_snap_get(struct hed_repo_snap * snap,
+                  unsigned int tbl,
+                  const uint8_t * key,
+                  size_t klen,
+                  uint8_t * * const value,
+                  size_t * vlen)
+	__hed_nonull(1, 3, 5, 6) __warn_result;
+
+extern int
+hed_repo_snap_get_many(struct hed_repo_snap * snap,
+                       unsigned int tbl,
+                       struct hed_repo_item * items,
+                       size_t nr)
+	__hed_nonull(1, 3) __warn_result;
+
+extern ssize_t
+hed_repo_snap_count(struct hed_repo_snap * snap,
+                    unsigned int tbl)
+	__hed_nonull(1) __warn_result;
+
+extern int
+hed_repo_snap_iter_range(struct hed_repo_iter * iter,
+                         struct hed_repo_snap * snap,
+                         unsigned int tbl,
+                         const uint8_t * lo,
+                         size_t llen,
+                         const uint8_t * hi,
+                         size_t hlen,
+                         unsigned int flags)
+	__hed_nonull(1, 2) __warn_result;
+
+extern int
+hed_repo_snap_iter_prefix(struct hed_repo_iter * iter,
+                          struct hed_repo_snap * snap,
+                          unsigned int tbl,
+                          const uint8_t * prefix,
+                          size_t plen,
+                          unsigned int flags)
+	__hed_nonull(1, 2, 4) __warn_result;
+
+extern struct hed_repo_iter *
+hed_repo_snap_create_iter(struct hed_repo_snap * snap,
+                          unsigned int tbl)
+	__hed_nonull(1) __warn_result;
+
+extern struct hed_repo_iter *
+hed_repo_snap_create_range_iter(struct hed_repo_snap * snap,
+                                unsigned int tbl,
+                                const uint8_t * lo,
+                                size_t llen,
+                                const uint8_t * hi,
+                                size_t hlen,
+                                unsigned int flags)
+	__hed_nonull(1) __warn_result;
+
+extern struct hed_repo_iter *
+hed_repo_snap_create_prefix_iter(struct hed_repo_snap * snap,
+                                 unsigned int tbl,
+                                 const uint8_t * prefix,
+                                 size_t plen,
+                                 unsigned int flags)
+	__hed_nonull(1, 3) __warn_result;
+
+extern int
+hed_repo_bulk_begin(struct hed_repo_bulk * bulk,
+                    struct hed_repo * repo,
+                    unsigned int tbl,
+                    size_t batch,
+                    unsigned int flags)
+	__hed_nonull(1, 2) __warn_result;
+
+extern int
+hed_repo_bulk_add(struct hed_repo_bulk * bulk,
+                  const uint8_t * key,
+                  size_t klen,
+                  const uint8_t * value,
+                  size_t vlen)
+	__hed_nonull(1, 2, 4) __warn_result;
+
+extern int
+hed_repo_bulk_end(struct hed_repo_bulk * bulk)
+	__hed_nonull(1) __warn_result;
+
+extern void
+hed_repo_bulk_abort(struct hed_repo_bulk * bulk)
+	__hed_nonull(1);
+
 static inline int __hed_nonull(1, 2, 3) __warn_result
 hed_repo_get_version(struct hed_repo * repo,
                      uint8_t * * const value,
@@ -127,9 +1157,9 @@ hed_repo_get_version(struct hed_repo * repo,
 	hed_assert_api(value);
 	hed_assert_api(vlen);
 
-	return hed_repo_get(repo, ".hed",
-	                    (const uint8_t *)".version", 8,
-	                    value, vlen);
+	return hed_repo_tbl_get(repo, HED_REPO_META_TBL(repo),
+	                        (const uint8_t *)".version", 8,
+	                        value, vlen);
 }
 
 static inline int __hed_nonull(1, 2) __warn_result
@@ -141,9 +1171,113 @@ hed_repo_set_version(struct hed_repo * repo,
 	hed_assert_api(value);
 	hed_assert_api(vlen);
 
-	return hed_repo_update(repo, ".hed",
-	                       (const uint8_t *)".version", 8,
-	                       value, vlen);
+	return hed_repo_tbl_update(repo, HED_REPO_META_TBL(repo),
+	                           (const uint8_t *)".version", 8,
+	                           value, vlen);
 }
 
+/*
+ * Define typed accessors for values of a troer serializable type:
+ * - hed_repo_tbl_get_<_name>() decodes a table value straight from the LMDB
+ *   map into the caller's structure,
+ * - hed_repo_tbl_put_<_name>() encodes a value right into the table page when
+ *   its packed size is fixed, or into a stack buffer before a single copy
+ *   otherwise,
+ * - hed_repo_step_<_name>() steps an iterator, decoding values on the fly.
+ * _dec and _enc are the type's decode and encode functions, _min and _max its
+ * PACKED_SIZE_MIN and PACKED_SIZE_MAX constants. Encoding failures leave the
+ * write transaction in an undefined state: it must be aborted.
+ */
+#define HED_REPO_DEFINE_TYPE(_name, _type, _dec, _enc, _min, _max) \
+	static inline int __hed_nonull(1, 3, 5) __warn_result \
+	hed_repo_tbl_get_ ## _name(struct hed_repo * repo, \
+	                           unsigned int tbl, \
+	                           const uint8_t * key, \
+	                           size_t klen, \
+	                           _type * value) \
+	{ \
+		struct dpack_decoder dec; \
+		uint8_t             *data; \
+		size_t               size; \
+		int                  ret; \
+		\
+		ret = hed_repo_tbl_get(repo, tbl, key, klen, &data, &size); \
+		if (ret) \
+			return ret; \
+		\
+		dpack_decoder_init_buffer(&dec, (const char *)data, size); \
+		ret = _dec(&dec, value); \
+		dpack_decoder_fini(&dec); \
+		\
+		return ret; \
+	} \
+	\
+	static inline int __hed_nonull(1, 3, 5) __warn_result \
+	hed_repo_tbl_put_ ## _name(struct hed_repo * repo, \
+	                           unsigned int tbl, \
+	                           const uint8_t * key, \
+	                           size_t klen, \
+	                           const _type * value) \
+	{ \
+		int ret; \
+		\
+		if (((_min) == (_max)) && !hed_repo_tbl_dup(repo, tbl)) { \
+			struct hed_repo_resv resv; \
+			\
+			ret = hed_repo_tbl_reserve(&resv, repo, tbl, \
+			                           key, klen, (_max)); \
+			if (ret) \
+				return ret; \
+			\
+			ret = _enc(&resv.encoder, value); \
+			if (ret) { \
+				dpack_encoder_fini(&resv.encoder, \
+				                   DPACK_ABORT); \
+				return ret; \
+			} \
+			\
+			return hed_repo_reserve_end(&resv); \
+		} \
+		else { \
+			uint8_t              buf[(_max)]; \
+			struct dpack_encoder enc; \
+			size_t               size; \
+			\
+			dpack_encoder_init_buffer(&enc, (char *)buf, \
+			                          sizeof(buf)); \
+			ret = _enc(&enc, value); \
+			size = dpack_encoder_space_used(&enc); \
+			dpack_encoder_fini(&enc, \
+			                   ret ? DPACK_ABORT : DPACK_DONE); \
+			if (ret) \
+				return ret; \
+			\
+			return hed_repo_tbl_update(repo, tbl, key, klen, \
+			                           buf, size); \
+		} \
+	} \
+	\
+	static inline int __hed_nonull(1, 4) __warn_result \
+	hed_repo_step_ ## _name(struct hed_repo_iter * iter, \
+	                        uint8_t * * const key, \
+	                        size_t * klen, \
+	                        _type * value) \
+	{ \
+		struct dpack_decoder dec; \
+		uint8_t             *data; \
+		size_t               size; \
+		int                  ret; \
+		int                  err; \
+		\
+		ret = hed_repo_step(iter, key, klen, &data, &size); \
+		if (ret < 0) \
+			return ret; \
+		\
+		dpack_decoder_init_buffer(&dec, (const char *)data, size); \
+		err = _dec(&dec, value); \
+		dpack_decoder_fini(&dec); \
+		\
+		return err ? err : ret; \
+	}
+
 #endif /* _HED_REPO_H */
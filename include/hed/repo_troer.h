@@ -0,0 +1,346 @@
+/******************************************************************************
+ * SPDX-License-Identifier: LGPL-3.0-only
+ *
+ * This file is part of hed.
+ ******************************************************************************/
+
+#ifndef _HED_REPO_TROER_H
+#define _HED_REPO_TROER_H
+
+#include <hed/repo.h>
+#include <endian.h>
+
+/*
+ * Key encodings. Packed values do not sort in value order, e.g. in_addr are
+ * variable width msgpack uints and timespecs raw host-endian bytes, which
+ * makes them useless as keys for range scans. hed_repo_enc_key_<type>()
+ * encodings are fixed width and big-endian instead, so that keys sort with
+ * memcmp() in value order; hed_repo_dec_key_<type>() reverse them.
+ * Compound keys sort by their first field first: services by address then
+ * port, networks by address then prefix length.
+ */
+
+#if defined(CONFIG_HED_TROER_BASE)
+
+#include <hed/base.h>
+
+/* Seconds with sign bit flipped so that negative times sort first. */
+#define HED_REPO_TIME_KEY_SIZE (sizeof(uint64_t) + sizeof(uint32_t))
+
+static inline void __hed_nonull(1, 2)
+hed_repo_enc_key_time(uint8_t * key, const struct timespec * value)
+{
+	hed_assert_api(key);
+	hed_assert_api(value);
+	hed_assert_api(value->tv_nsec >= 0);
+	hed_assert_api(value->tv_nsec < 1000000000L);
+
+	uint64_t sec = htobe64((uint64_t)value->tv_sec ^ (1ULL << 63));
+	uint32_t nsec = htobe32((uint32_t)value->tv_nsec);
+
+	memcpy(key, &sec, sizeof(sec));
+	memcpy(&key[sizeof(sec)], &nsec, sizeof(nsec));
+}
+
+static inline void __hed_nonull(1, 2)
+hed_repo_dec_key_time(struct timespec * value, const uint8_t * key)
+{
+	hed_assert_api(value);
+	hed_assert_api(key);
+
+	uint64_t sec;
+	uint32_t nsec;
+
+	memcpy(&sec, key, sizeof(sec));
+	memcpy(&nsec, &key[sizeof(sec)], sizeof(nsec));
+	value->tv_sec = (time_t)(be64toh(sec) ^ (1ULL << 63));
+	value->tv_nsec = (long)be32toh(nsec);
+}
+
+HED_REPO_DEFINE_TYPE(time,
+                     struct timespec,
+                     hed_decode_time,
+                     hed_encode_time,
+                     HED_TIME_PACKED_SIZE_MIN,
+                     HED_TIME_PACKED_SIZE_MAX)
+
+#endif /* defined(CONFIG_HED_TROER_BASE) */
+
+#if defined(CONFIG_HED_TROER_INET)
+
+#include <hed/inet.h>
+
+#define HED_REPO_PORT_KEY_SIZE    sizeof(uint16_t)
+#define HED_REPO_IN_ADDR_KEY_SIZE sizeof(struct in_addr)
+#define HED_REPO_IN6_ADDR_KEY_SIZE \
+	sizeof(struct in6_addr)
+#define HED_REPO_IN_SVC_KEY_SIZE \
+	(HED_REPO_IN_ADDR_KEY_SIZE + HED_REPO_PORT_KEY_SIZE)
+#define HED_REPO_IN6_SVC_KEY_SIZE \
+	(HED_REPO_IN6_ADDR_KEY_SIZE + HED_REPO_PORT_KEY_SIZE)
+#define HED_REPO_IN_NET_KEY_SIZE \
+	(HED_REPO_IN_ADDR_KEY_SIZE + sizeof(uint8_t))
+#define HED_REPO_IN6_NET_KEY_SIZE \
+	(HED_REPO_IN6_ADDR_KEY_SIZE + sizeof(uint8_t))
+
+static inline void __hed_nonull(1)
+hed_repo_enc_key_port(uint8_t * key, uint16_t value)
+{
+	hed_assert_api(key);
+
+	uint16_t port = htobe16(value);
+
+	memcpy(key, &port, sizeof(port));
+}
+
+static inline uint16_t __hed_nonull(1) __warn_result
+hed_repo_dec_key_port(const uint8_t * key)
+{
+	hed_assert_api(key);
+
+	uint16_t port;
+
+	memcpy(&port, key, sizeof(port));
+
+	return be16toh(port);
+}
+
+/* Addresses are held in network byte order already. */
+static inline void __hed_nonull(1, 2)
+hed_repo_enc_key_in_addr(uint8_t * key, const struct in_addr * value)
+{
+	hed_assert_api(key);
+	hed_assert_api(value);
+
+	memcpy(key, &value->s_addr, sizeof(value->s_addr));
+}
+
+static inline void __hed_nonull(1, 2)
+hed_repo_dec_key_in_addr(struct in_addr * value, const uint8_t * key)
+{
+	hed_assert_api(value);
+	hed_assert_api(key);
+
+	memcpy(&value->s_addr, key, sizeof(value->s_addr));
+}
+
+static inline void __hed_nonull(1, 2)
+hed_repo_enc_key_in6_addr(uint8_t * key, const struct in6_addr * value)
+{
+	hed_assert_api(key);
+	hed_assert_api(value);
+
+	memcpy(key, value->s6_addr, sizeof(value->s6_addr));
+}
+
+static inline void __hed_nonull(1, 2)
+hed_repo_dec_key_in6_addr(struct in6_addr * value, const uint8_t * key)
+{
+	hed_assert_api(value);
+	hed_assert_api(key);
+
+	memcpy(value->s6_addr, key, sizeof(value->s6_addr));
+}
+
+static inline void __hed_nonull(1, 2)
+hed_repo_enc_key_in_svc(uint8_t * key, const struct hed_in_svc * value)
+{
+	hed_assert_api(key);
+	hed_assert_api(value);
+
+	hed_repo_enc_key_in_addr(key, &value->addr);
+	hed_repo_enc_key_port(&key[HED_REPO_IN_ADDR_KEY_SIZE], value->port);
+}
+
+static inline void __hed_nonull(1, 2)
+hed_repo_dec_key_in_svc(struct hed_in_svc * value, const uint8_t * key)
+{
+	hed_assert_api(value);
+	hed_assert_api(key);
+
+	hed_repo_dec_key_in_addr(&value->addr, key);
+	value->port = hed_repo_dec_key_port(&key[HED_REPO_IN_ADDR_KEY_SIZE]);
+}
+
+static inline void __hed_nonull(1, 2)
+hed_repo_enc_key_in6_svc(uint8_t * key, const struct hed_in6_svc * value)
+{
+	hed_assert_api(key);
+	hed_assert_api(value);
+
+	hed_repo_enc_key_in6_addr(key, &value->addr);
+	hed_repo_enc_key_port(&key[HED_REPO_IN6_ADDR_KEY_SIZE], value->port);
+}
+
+static inline void __hed_nonull(1, 2)
+hed_repo_dec_key_in6_svc(struct hed_in6_svc * value, const uint8_t * key)
+{
+	hed_assert_api(value);
+	hed_assert_api(key);
+
+	hed_repo_dec_key_in6_addr(&value->addr, key);
+	value->port = hed_repo_dec_key_port(&key[HED_REPO_IN6_ADDR_KEY_SIZE]);
+}
+
+static inline void __hed_nonull(1, 2)
+hed_repo_enc_key_in_net(uint8_t * key, const struct hed_in_net * value)
+{
+	hed_assert_api(key);
+	hed_assert_api(value);
+	hed_assert_api(value->prefix <= 32);
+
+	hed_repo_enc_key_in_addr(key, &value->addr);
+	key[HED_REPO_IN_ADDR_KEY_SIZE] = value->prefix;
+}
+
+static inline void __hed_nonull(1, 2)
+hed_repo_dec_key_in_net(struct hed_in_net * value, const uint8_t * key)
+{
+	hed_assert_api(value);
+	hed_assert_api(key);
+
+	hed_repo_dec_key_in_addr(&value->addr, key);
+	value->prefix = key[HED_REPO_IN_ADDR_KEY_SIZE];
+}
+
+static inline void __hed_nonull(1, 2)
+hed_repo_enc_key_in6_net(uint8_t * key, const struct hed_in6_net * value)
+{
+	hed_assert_api(key);
+	hed_assert_api(value);
+	hed_assert_api(value->prefix <= 128);
+
+	hed_repo_enc_key_in6_addr(key, &value->addr);
+	key[HED_REPO_IN6_ADDR_KEY_SIZE] = value->prefix;
+}
+
+static inline void __hed_nonull(1, 2)
+hed_repo_dec_key_in6_net(struct hed_in6_net * value, const uint8_t * key)
+{
+	hed_assert_api(value);
+	hed_assert_api(key);
+
+	hed_repo_dec_key_in6_addr(&value->addr, key);
+	value->prefix = key[HED_REPO_IN6_ADDR_KEY_SIZE];
+}
+
+/*
+ * Compute the [lo, hi) key range spanning addresses of a network, suitable for
+ * hed_repo_*_iter_range() over tables keyed by addresses, services or
+ * networks. Returns false when the network reaches the last address, in which
+ * case the range has no upper bound and hi is left untouched.
+ */
+static inline bool __hed_nonull(1, 2, 3) __warn_result
+hed_repo_in_net_range(const struct hed_in_net * net, uint8_t * lo, uint8_t * hi)
+{
+	hed_assert_api(net);
+	hed_assert_api(net->prefix <= 32);
+	hed_assert_api(lo);
+	hed_assert_api(hi);
+
+	uint64_t size = 1ULL << (32 - net->prefix);
+	uint64_t first = be32toh(net->addr.s_addr) & ~(size - 1);
+	uint32_t addr;
+
+	addr = htobe32((uint32_t)first);
+	memcpy(lo, &addr, sizeof(addr));
+
+	if ((first + size) > UINT32_MAX)
+		return false;
+
+	addr = htobe32((uint32_t)(first + size));
+	memcpy(hi, &addr, sizeof(addr));
+
+	return true;
+}
+
+static inline bool __hed_nonull(1, 2, 3) __warn_result
+hed_repo_in6_net_range(const struct hed_in6_net * net,
+                       uint8_t * lo,
+                       uint8_t * hi)
+{
+	hed_assert_api(net);
+	hed_assert_api(net->prefix <= 128);
+	hed_assert_api(lo);
+	hed_assert_api(hi);
+
+	unsigned int b = net->prefix / 8;
+	unsigned int bit = net->prefix % 8;
+	unsigned int carry;
+
+	memcpy(lo, net->addr.s6_addr, HED_REPO_IN6_ADDR_KEY_SIZE);
+	if (b < HED_REPO_IN6_ADDR_KEY_SIZE) {
+		lo[b] &= (uint8_t)(0xff00U >> bit);
+		memset(&lo[b + 1], 0, HED_REPO_IN6_ADDR_KEY_SIZE - b - 1);
+	}
+
+	if (!net->prefix)
+		return false;
+
+	/* Add one unit at the last prefix bit, carrying leftward. */
+	memcpy(hi, lo, HED_REPO_IN6_ADDR_KEY_SIZE);
+	b = (net->prefix - 1U) / 8;
+	carry = 1U << (7 - ((net->prefix - 1U) % 8));
+	while (carry) {
+		carry += hi[b];
+		hi[b] = (uint8_t)carry;
+		carry >>= 8;
+		if (!b--)
+			break;
+	}
+
+	return !carry;
+}
+
+HED_REPO_DEFINE_TYPE(ether_addr,
+                     struct ether_addr,
+                     hed_decode_ether_addr,
+                     hed_encode_ether_addr,
+                     HED_ETHER_ADDR_PACKED_SIZE_MIN,
+                     HED_ETHER_ADDR_PACKED_SIZE_MAX)
+
+HED_REPO_DEFINE_TYPE(in_addr,
+                     struct in_addr,
+                     hed_decode_in_addr,
+                     hed_encode_in_addr,
+                     HED_IN_ADDR_PACKED_SIZE_MIN,
+                     HED_IN_ADDR_PACKED_SIZE_MAX)
+
+HED_REPO_DEFINE_TYPE(in6_addr,
+                     struct in6_addr,
+                     hed_decode_in6_addr,
+                     hed_encode_in6_addr,
+                     HED_IN6_ADDR_PACKED_SIZE_MIN,
+                     HED_IN6_ADDR_PACKED_SIZE_MAX)
+
+HED_REPO_DEFINE_TYPE(in_svc,
+                     struct hed_in_svc,
+                     hed_dec_in_svc,
+                     hed_enc_in_svc,
+                     HED_IN_SVC_PACKED_SIZE_MIN,
+                     HED_IN_SVC_PACKED_SIZE_MAX)
+
+HED_REPO_DEFINE_TYPE(in6_svc,
+                     struct hed_in6_svc,
+                     hed_dec_in6_svc,
+                     hed_enc_in6_svc,
+                     HED_IN6_SVC_PACKED_SIZE_MIN,
+                     HED_IN6_SVC_PACKED_SIZE_MAX)
+
+HED_REPO_DEFINE_TYPE(in_net,
+                     struct hed_in_net,
+                     hed_dec_in_net,
+                     hed_enc_in_net,
+                     HED_IN_NET_PACKED_SIZE_MIN,
+                     HED_IN_NET_PACKED_SIZE_MAX)
+
+HED_REPO_DEFINE_TYPE(in6_net,
+                     struct hed_in6_net,
+                     hed_dec_in6_net,
+                     hed_enc_in6_net,
+                     HED_IN6_NET_PACKED_SIZE_MIN,
+                     HED_IN6_NET_PACKED_SIZE_MAX)
+
+#endif /* defined(CONFIG_HED_TROER_INET) */
+
+#endif /* _HED_REPO_TROER_H */
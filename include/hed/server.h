@@ -9,8 +9,64 @@
 
 #include <hed/cdefs.h>
 #include <hed/rpc.h>
+#include <hed/repo.h>
 #include <galv/session.h>
 #include <galv/unix.h>
+#include <utils/timer.h>
+
+/*
+ * Called once the group transaction a request took part in has been
+ * committed, with the commit status. Responses to mutating requests should be
+ * sent from here. Completions must not join the group again.
+ */
+typedef void (hed_srv_commit_fn)(int status, void * ctx);
+
+struct hed_srv_commit {
+	hed_srv_commit_fn *fn;
+	void              *ctx;
+};
+
+/*
+ * Group commit: mutating requests dispatched within the same hed_srv_process()
+ * iteration, or within `window' milliseconds when not zero, share a single
+ * write transaction on the attached repo and thus a single sync.
+ * Each request runs within a savepoint of its own, so that aborting it spares
+ * other requests of the group, unless the repo uses writemap.
+ */
+struct hed_srv_group {
+	struct hed_repo       *repo;
+	struct etux_timer      timer;
+	int                    window;
+	unsigned int           nr;
+	struct hed_repo_save   save;
+	bool                   saved;
+	struct hed_srv_commit  pending[CONFIG_HED_SRV_GROUP_NR];
+};
+
+/*
+ * Called from the server loop once changes committed to the attached repo were
+ * published to its change feed. Subscribers, including those relaying changes
+ * to RPC clients, should drain their struct hed_repo_sub from here.
+ */
+typedef int (hed_srv_feed_fn)(void * ctx);
+
+struct hed_srv_feed {
+	struct upoll_worker  worker;
+	hed_srv_feed_fn     *fn;
+	void                *ctx;
+};
+
+/*
+ * Expiry sweeper: every `period' milliseconds, entries of the attached repo
+ * whose deadline has passed are deleted by batches of at most
+ * CONFIG_HED_SRV_SWEEP_NR entries, each batch joining the group transaction.
+ * A full batch schedules the next one a millisecond later, so that requests
+ * keep being served between batches.
+ */
+struct hed_srv_sweep {
+	struct etux_timer timer;
+	int               period;
+};
 
 struct hed_server {
 	struct galv_rpc_accept            accept;
@@ -19,6 +75,9 @@ struct hed_server {
 	struct galv_repo                  repo;
 	struct upoll_worker               sig_worker;
 	int                               sig_fd;
+	struct hed_srv_group              group;
+	struct hed_srv_feed               feed;
+	struct hed_srv_sweep              sweep;
 };
 
 extern int
@@ -53,6 +112,48 @@ extern void
 hed_srv_fini(struct hed_server *srv)
 	__hed_nonull(1);
 
+extern void
+hed_srv_attach_repo(struct hed_server *srv,
+                    struct hed_repo   *repo,
+                    int                window)
+	__hed_nonull(1, 2);
+
+extern int
+hed_srv_repo_start(struct hed_server *srv)
+	__hed_nonull(1) __warn_result;
+
+extern int
+hed_srv_repo_commit(struct hed_server *srv,
+                    hed_srv_commit_fn *fn,
+                    void              *ctx)
+	__hed_nonull(1, 2) __warn_result;
+
+extern void
+hed_srv_repo_abort(struct hed_server *srv)
+	__hed_nonull(1);
+
+extern int
+hed_srv_repo_flush(struct hed_server *srv)
+	__hed_nonull(1);
+
+extern int
+hed_srv_watch_feed(struct hed_server *srv,
+                   hed_srv_feed_fn   *fn,
+                   void              *ctx)
+	__hed_nonull(1, 2) __warn_result;
+
+extern void
+hed_srv_unwatch_feed(struct hed_server *srv)
+	__hed_nonull(1);
+
+extern void
+hed_srv_start_sweep(struct hed_server *srv, int period)
+	__hed_nonull(1);
+
+extern void
+hed_srv_stop_sweep(struct hed_server *srv)
+	__hed_nonull(1);
+
 static inline struct upoll * __hed_nonull(1)
 hed_srv_get_upoll(struct hed_server *srv)
 {
@@ -5,6 +5,150 @@
  ******************************************************************************/
 
 #include "hed/repo.h"
+#include <dpack/bin.h>
+#include <dpack/scalar.h>
+#include <dpack/string.h>
+#include <endian.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utils/timer.h>
+
+/*
+ * The expiry table records deadlines of HED_REPO_TBL_TTL table entries, in
+ * milliseconds since the Epoch, under two kinds of keys:
+ * - REPO_TTL_DEADLINE keys made of the big-endian deadline, table identifier
+ *   and entry key, sorting entries by deadline. Their value is the tag byte
+ *   alone: the undo journal tells missing keys by their empty pre-image;
+ * - REPO_TTL_ENTRY keys made of the table identifier and entry key, holding
+ *   the big-endian deadline so that it may be located again.
+ * Table identifiers are 16-bit big-endian integers bound to table names by
+ * REPO_TTL_NAME keys, made of the table name, so that deadlines survive tables
+ * being reordered or added across opens.
+ * It is opened only when some table is given HED_REPO_TBL_TTL.
+ */
+#define REPO_TTL_TBL(_repo) \
+	((unsigned int)(_repo)->nb + 1)
+
+#if defined(CONFIG_HED_REPO_3PC)
+
+/*
+ * The undo journal table records the pre-image of every key modified by the
+ * current write transaction so that hed_repo_rollback() may revert it once
+ * committed.
+ * Keys are made of the table index followed by the modified key. Values hold
+ * the pre-image, an empty value meaning the key did not exist.
+ */
+#define REPO_UNDO_TBL(_repo) \
+	((unsigned int)(_repo)->nb + 2)
+
+#define REPO_META_NR 3U
+
+#else  /* !defined(CONFIG_HED_REPO_3PC) */
+
+#define REPO_META_NR 2U
+
+#endif /* defined(CONFIG_HED_REPO_3PC) */
+
+/*
+ * Turn an error into a negative count: MDB_* codes are negative already while
+ * LMDB returns errno values along with them.
+ */
+static ssize_t __warn_result
+repo_count_error(int ret)
+{
+	hed_assert_intern(ret);
+
+	return (ret > 0) ? -ret : ret;
+}
+
+/* Tell whether snapshots, scans or compactions hold read transactions. */
+static bool __hed_nonull(1) __warn_result
+repo_snap_busy(struct hed_repo * repo)
+{
+	hed_assert_intern(repo);
+
+	bool busy;
+
+	pthread_mutex_lock(&repo->snap_lock);
+	busy = !!repo->snap_nr;
+	pthread_mutex_unlock(&repo->snap_lock);
+
+	return busy;
+}
+
+static void __hed_nonull(1)
+repo_drain_snap(struct hed_repo * repo)
+{
+	hed_assert_intern(repo);
+	hed_assert_intern(!repo->snap_nr);
+
+	struct hed_repo_snap *snap;
+
+	while (repo->snap_pool) {
+		snap = repo->snap_pool;
+		repo->snap_pool = snap->next;
+
+		mdb_txn_abort(snap->txn);
+		free(snap);
+	}
+}
+
+static const struct hed_repo_conf repo_dflt_conf = {
+	.map_size    = 0,
+	.map_max     = 0,
+	.max_readers = 0,
+	.durability  = HED_REPO_SYNC,
+	.writemap    = false,
+	.sync_period = 0,
+	.feed_size   = 0
+};
+
+static void __hed_nonull(1)
+repo_sync_expire(struct etux_timer * timer)
+{
+	hed_assert_intern(timer);
+
+	struct hed_repo *repo;
+
+	repo = containerof(timer, struct hed_repo, sync_timer);
+	hed_assert_intern(repo->env);
+	hed_assert_intern(repo->conf.sync_period > 0);
+
+	/* Flush what relaxed durability modes left unsynced. */
+	mdb_env_sync(repo->env, 1);
+	etux_timer_arm_msec(&repo->sync_timer, repo->conf.sync_period);
+}
+
+static unsigned int __hed_nonull(1) __warn_result
+repo_env_flags(const struct hed_repo_conf * conf)
+{
+	hed_assert_intern(conf);
+
+	unsigned int f = conf->writemap ? MDB_WRITEMAP : 0;
+
+	switch (conf->durability) {
+	case HED_REPO_SYNC:
+		break;
+
+	case HED_REPO_NOMETASYNC:
+		f |= MDB_NOMETASYNC;
+		break;
+
+	case HED_REPO_MAPASYNC:
+		f |= MDB_WRITEMAP | MDB_MAPASYNC;
+		break;
+
+	case HED_REPO_NOSYNC:
+		f |= MDB_NOSYNC;
+		break;
+
+	default:
+		hed_assert_intern(0);
+	}
+
+	return f;
+}
 
 static void __hed_nonull(1)
 repo_close(struct hed_repo * repo)
@@ -14,486 +158,6163 @@ repo_close(struct hed_repo * repo)
 	if (!repo->env)
 		return;
 
+	if (repo->conf.sync_period)
+		etux_timer_cancel(&repo->sync_timer);
+
 	if (repo->txn)
 		hed_repo_abort(repo);
 
+	/* Pooled read transactions must not outlive the environment. */
+	repo_drain_snap(repo);
+
 	mdb_env_close(repo->env);
 	repo->env = NULL;
 
 }
 
-static int __hed_nonull(1, 2)
-repo_open_table(struct hed_repo * repo, const char * table, int flags)
+static int __hed_nonull(1, 2, 5)
+repo_open_table(struct hed_repo * repo,
+                const char * table,
+                int flags,
+                unsigned int opts,
+                MDB_dbi * dbi)
 {
 	hed_assert_intern(repo);
 	hed_assert_intern(repo->env);
 	hed_assert_intern(repo->txn);
 	hed_assert_intern(table);
+	hed_assert_intern(dbi);
 
 	int ret;
-	MDB_dbi dbi;
 	unsigned int f = flags & O_CREAT ? MDB_CREATE : 0;
 
-	ret = mdb_dbi_open(repo->txn, table, f, &dbi);
+	if (opts & HED_REPO_TBL_INTKEY)
+		f |= MDB_INTEGERKEY;
+	if (opts & HED_REPO_TBL_DUP)
+		f |= MDB_DUPSORT;
+	if (opts & (HED_REPO_TBL_DUPFIXED | HED_REPO_TBL_INTDUP))
+		f |= MDB_DUPFIXED;
+	if (opts & HED_REPO_TBL_INTDUP)
+		f |= MDB_INTEGERDUP;
+
+	ret = mdb_dbi_open(repo->txn, table, f, dbi);
 	if (ret)
 		return ret;
 
 	if (!(flags & O_TRUNC))
 		return 0;
 
-	return mdb_drop(repo->txn, dbi, 0);
+	return mdb_drop(repo->txn, *dbi, 0);
 }
 
-static int __hed_nonull(1)
-repo_open(struct hed_repo * repo, int flags)
+static int __hed_nonull(1, 2)
+repo_lookup_table(const struct hed_repo * repo, const char * table)
 {
 	hed_assert_intern(repo);
-	hed_assert_intern(!repo->env);
-	hed_assert_intern(!repo->txn);
+	hed_assert_intern(table);
 
-	int ret;
-	unsigned int f = flags & O_RDONLY ? MDB_RDONLY : 0;
 	size_t i;
-	uint32_t seq = 0;
 
-	ret = mdb_env_create(&repo->env);
-	if (ret)
-		return ret;
+	for (i = 0; i < repo->nb; i++) {
+		/* Callers mostly pass strings from the table array itself. */
+		if ((repo->table[i] == table) || !strcmp(repo->table[i], table))
+			return (int)i;
+	}
 
-	ret = mdb_env_set_maxdbs(repo->env, (MDB_dbi)(repo->nb + 1));
-	if (ret)
-		goto error;
+	if (!strcmp(table, ".hed"))
+		return (int)HED_REPO_META_TBL(repo);
 
-	ret = mdb_env_open(repo->env, stroll_lvstr_cstr(&repo->path),
-			   f | MDB_NOSUBDIR, repo->mode);
-	if (ret)
-		goto error;
+	return -ENOENT;
+}
 
-	ret = hed_repo_start(repo);
-	if (ret)
-		goto error;
+enum repo_log_op {
+	REPO_LOG_PUT,
+	REPO_LOG_DEL,
+	REPO_LOG_DROP
+};
 
-	ret = repo_open_table(repo, ".hed", flags);
-	if (ret)
-		goto error;
+/* Replay log record header, followed by key then value bytes. */
+struct repo_log_rec {
+	unsigned int op;
+	unsigned int tbl;
+	unsigned int flags;
+	size_t       klen;
+	size_t       vlen;
+};
 
-	for (i = 0; i < repo->nb; i++) {
-		hed_assert_api(repo->table[i]);
-		hed_assert_api(repo->table[i][0] != '.');
+static int
+repo_apply(MDB_txn * txn,
+           MDB_dbi dbi,
+           enum repo_log_op op,
+           MDB_val * idx,
+           MDB_val * content,
+           unsigned int flags)
+{
+	hed_assert_intern(txn);
 
-		ret = repo_open_table(repo, repo->table[i], flags);
-		if (ret)
-			goto error;
-	}
+	switch (op) {
+	case REPO_LOG_PUT:
+		hed_assert_intern(idx);
+		hed_assert_intern(content);
+		return mdb_put(txn, dbi, idx, content, flags);
 
-	if (flags & O_TRUNC) {
-		for (i = 0; i < repo->nb; i++) {
-			ret = hed_repo_update(repo, ".hed",
-				(const uint8_t *)repo->table[i],
-				strlen(repo->table[i]),
-				(const uint8_t *)&seq, sizeof(seq));
-			if (ret)
-				goto error;
-		}
-	}
+	case REPO_LOG_DEL:
+		hed_assert_intern(idx);
+		/* A value selects the duplicate to delete. */
+		return mdb_del(txn, dbi, idx,
+		               (content && content->mv_size) ? content : NULL);
 
-	return hed_repo_commit(repo);
-error:
-	repo_close(repo);
-	return ret;
+	default:
+		hed_assert_intern(op == REPO_LOG_DROP);
+		return mdb_drop(txn, dbi, 0);
+	}
 }
 
-int
-hed_repo_open(struct hed_repo    *repo,
-              const char         *path,
-              const char * const *table,
-              size_t              nb,
-              int                 flags,
-              mode_t              mode)
+static int __hed_nonull(1)
+repo_log_push(struct hed_repo * repo,
+              enum repo_log_op op,
+              unsigned int tbl,
+              const MDB_val * idx,
+              const MDB_val * content,
+              unsigned int flags)
 {
-	hed_assert_api(repo);
-	hed_assert_api(path);
-	hed_assert_api(strlen(path) > 0);
-	hed_assert_api(!(flags & (~(O_RDWR | O_RDONLY | O_CREAT | O_TRUNC))));
-	hed_assert_api(!(flags & O_CREAT) | (flags & O_RDWR));
-	hed_assert_api(!(flags & O_TRUNC) | (flags & O_CREAT));
+	hed_assert_intern(repo);
+	hed_assert_intern(repo->log.on);
 
+	struct hed_repo_log *log = &repo->log;
+	struct repo_log_rec rec = {
+		.op    = op,
+		.tbl   = tbl,
+		.flags = flags,
+		.klen  = idx ? idx->mv_size : 0,
+		.vlen  = content ? content->mv_size : 0
+	};
+	size_t sz = sizeof(rec) + rec.klen + rec.vlen;
 
-	int ret;
-	char *backup;
+	if ((log->used + sz) > log->capa) {
+		size_t capa = stroll_max(2 * log->capa, log->used + sz);
+		uint8_t *data;
 
-	repo->env = NULL;
-	repo->txn = NULL;
+		data = realloc(log->data, capa);
+		if (!data)
+			return -ENOMEM;
 
-STROLL_IGNORE_WARN("-Wcast-qual")
-	*(int *)&repo->flags = flags & O_ACCMODE;
-	*(mode_t *)&repo->mode = mode;
-	*(char  ***)&repo->table = (char **)table;
-	*(size_t *)&repo->nb = nb;
-STROLL_RESTORE_WARN
+		log->data = data;
+		log->capa = capa;
+	}
 
-	backup = malloc((strlen(path) + 8) * sizeof(char));
-	if (!backup)
-		return -ENOMEM;
+	memcpy(&log->data[log->used], &rec, sizeof(rec));
+	log->used += sizeof(rec);
+	if (rec.klen) {
+		memcpy(&log->data[log->used], idx->mv_data, rec.klen);
+		log->used += rec.klen;
+	}
+	if (rec.vlen) {
+		/* Reserved values are filled in once encoded. */
+		if (!(flags & MDB_RESERVE))
+			memcpy(&log->data[log->used], content->mv_data,
+			       rec.vlen);
+		log->used += rec.vlen;
+	}
 
-	snprintf(backup, (strlen(path) + 8), "%s-backup", path);
-	ret = stroll_lvstr_init_cede(&repo->backup, backup);
-	if (ret)
-		goto free_backup;
+	return 0;
+}
 
-	ret = stroll_lvstr_init_dup(&repo->path, path);
-	if (ret)
-		goto free_backup;
+static int __hed_nonull(1)
+repo_log_replay(struct hed_repo * repo, size_t off, size_t end)
+{
+	hed_assert_intern(repo);
+	hed_assert_intern(repo->txn);
+	hed_assert_intern(off <= end);
+	hed_assert_intern(end <= repo->log.used);
 
-	ret = repo_open(repo, flags);
-	if (ret)
-		goto free_path;
+	const struct hed_repo_log *log = &repo->log;
+	struct repo_log_rec rec;
+	MDB_val idx;
+	MDB_val content;
+	int ret;
 
-	return 0;
+	while (off < end) {
+		memcpy(&rec, &log->data[off], sizeof(rec));
+		off += sizeof(rec);
 
-free_path:
-	stroll_lvstr_fini(&repo->path);
-free_backup:
-	stroll_lvstr_fini(&repo->backup);
-	return ret;
-}
+		idx.mv_data = &log->data[off];
+		idx.mv_size = rec.klen;
+		off += rec.klen;
 
-void
-hed_repo_close(struct hed_repo * repo)
-{
-	hed_assert_api(repo);
+		content.mv_data = &log->data[off];
+		content.mv_size = rec.vlen;
+		off += rec.vlen;
 
-	if (!repo->env)
-		return;
+		ret = repo_apply(repo->txn, repo->dbi[rec.tbl], rec.op,
+		                 &idx, &content,
+		                 rec.flags & ~((unsigned int)MDB_RESERVE));
+		if (ret)
+			return ret;
+	}
 
-	repo_close(repo);
-	if (repo->flags & O_RDWR)
-		remove(stroll_lvstr_cstr(&repo->backup));
-	stroll_lvstr_fini(&repo->path);
-	stroll_lvstr_fini(&repo->backup);
+	return 0;
 }
 
-int
-hed_repo_reload(struct hed_repo * repo)
+static void __hed_nonull(1)
+repo_log_reset(struct hed_repo * repo, bool on)
 {
-	hed_assert_api(repo);
-	hed_assert_api(repo->env);
-	hed_assert_api(!repo->txn);
+	hed_assert_intern(repo);
 
-	repo_close(repo);
-	return repo_open(repo, repo->flags);
+	repo->log.used = 0;
+	repo->log.cursor_nr = 0;
+	repo->log.on = on;
+	repo->log.lost = false;
 }
 
-int
-hed_repo_start(struct hed_repo * repo)
+/* Replay the log into a fresh transaction, nesting savepoints back. */
+static int __hed_nonull(1)
+repo_save_replay(struct hed_repo * repo,
+                 struct hed_repo_save * save,
+                 size_t end)
 {
-	hed_assert_api(repo);
-	hed_assert_api(repo->env);
-	hed_assert_api(!repo->txn);
-
-	unsigned int flags = repo->flags & O_RDONLY ? MDB_RDONLY : 0;
+	hed_assert_intern(repo);
+	hed_assert_intern(repo->txn);
 
-#if defined(CONFIG_HED_REPO_3PC)
-	int fd;
+	size_t off = 0;
 	int ret;
 
-	if (!flags) {
-		fd = ufile_new(stroll_lvstr_cstr(&repo->backup),
-			O_RDWR | O_TRUNC | O_CLOEXEC, repo->mode);
-		if (fd < 0)
-			return fd;
-
-		ret = mdb_env_copyfd(repo->env, fd);
-		ufile_close(fd);
+	if (save) {
+		ret = repo_save_replay(repo, save->prev, save->log_mark);
 		if (ret)
 			return ret;
-	}
-#endif
-
-	return mdb_txn_begin(repo->env, NULL, flags, &repo->txn);
-}
 
-int
-hed_repo_commit(struct hed_repo * repo)
-{
-	hed_assert_api(repo);
-	hed_assert_api(repo->env);
-	hed_assert_api(repo->txn);
+		save->parent = repo->txn;
+		ret = mdb_txn_begin(repo->env, save->parent, 0, &repo->txn);
+		if (ret) {
+			repo->txn = save->parent;
+			return ret;
+		}
 
-	int ret;
+		off = save->log_mark;
+	}
 
-	ret = mdb_txn_commit(repo->txn);
-	repo->txn = NULL;
-	return ret;
+	return repo_log_replay(repo, off, end);
 }
 
-void
-hed_repo_abort(struct hed_repo * repo)
+/* Release the write transaction along with savepoints nested into it. */
+static void __hed_nonull(1)
+repo_txn_abort(struct hed_repo * repo)
 {
-	hed_assert_api(repo);
-	hed_assert_api(repo->env);
-	hed_assert_api(repo->txn);
+	hed_assert_intern(repo);
 
-	mdb_txn_abort(repo->txn);
-	repo->txn = NULL;
-}
+	struct hed_repo_save *save;
+	MDB_txn *root = repo->txn;
 
-#if defined(CONFIG_HED_REPO_3PC)
-int
-hed_repo_rollback(struct hed_repo * repo)
-{
-	hed_assert_api(repo);
-	hed_assert_api(repo->env);
-	hed_assert_api(!repo->txn);
+	for (save = repo->save; save; save = save->prev) {
+		/* Savepoints not nested back by a failed replay have none. */
+		if (save->parent)
+			root = save->parent;
+		save->parent = NULL;
+	}
 
-	repo_close(repo);
-	rename(stroll_lvstr_cstr(&repo->backup), stroll_lvstr_cstr(&repo->path));
-	return repo_open(repo, repo->flags);
+	if (root)
+		mdb_txn_abort(root);
+	repo->txn = NULL;
 }
-#endif
 
-int
-hed_repo_get(struct hed_repo * repo,
-             const char * table,
-             const uint8_t * key,
-             size_t klen,
-             uint8_t * * const value,
-             size_t * vlen)
+/*
+ * Compute the size the map should be enlarged to, geometrically up to the
+ * configured maximum. Unless `full' is set, growth is due only when more than
+ * 3/4 of the map is in use, so that transactions seldom need to be replayed:
+ * `size' is zeroed when no growth is due.
+ * Give up with MDB_MAP_FULL once the maximum is reached.
+ */
+static int __hed_nonull(1, 3)
+repo_grow_size(struct hed_repo * repo, bool full, size_t * size)
 {
-	hed_assert_api(repo);
-	hed_assert_api(repo->env);
-	hed_assert_api(repo->txn);
-	hed_assert_api(table);
-	hed_assert_api(key);
-	hed_assert_api(klen > 0);
-	hed_assert_api(value);
-	hed_assert_api(vlen);
+	hed_assert_intern(repo);
+	hed_assert_intern(repo->env);
+	hed_assert_intern(repo->conf.map_max);
+	hed_assert_intern(size);
 
+	MDB_envinfo info;
+	MDB_stat stat;
 	int ret;
-	MDB_dbi dbi;
-	MDB_val content;
-STROLL_IGNORE_WARN("-Wcast-qual")
-	MDB_val idx = {
-		.mv_data = (uint8_t *)key,
-		.mv_size = klen
-	};
-STROLL_RESTORE_WARN
 
-	ret = mdb_dbi_open(repo->txn, table, 0, &dbi);
+	*size = 0;
+
+	ret = mdb_env_info(repo->env, &info);
 	if (ret)
 		return ret;
 
-	ret = mdb_get(repo->txn, dbi, &idx, &content);
+	ret = mdb_env_stat(repo->env, &stat);
 	if (ret)
 		return ret;
 
-	*value = content.mv_data;
-	*vlen = content.mv_size;
+	if (!full &&
+	    (((info.me_last_pgno + 1) * stat.ms_psize) <=
+	     ((info.me_mapsize / 4) * 3)))
+		return 0;
+
+	*size = stroll_min(2 * info.me_mapsize,
+	                   repo->conf.map_max / stat.ms_psize * stat.ms_psize);
+	if (*size <= info.me_mapsize)
+		return MDB_MAP_FULL;
+
 	return 0;
 }
 
-int
-hed_repo_update(struct hed_repo * repo,
-                const char * table,
-                const uint8_t * key,
-                size_t klen,
-                const uint8_t * value,
-                size_t vlen)
+/*
+ * Resize the map. This is allowed only while no transaction is running within
+ * the process: must be called with snap_lock held, and gives up with
+ * MDB_MAP_FULL while snapshots are in use.
+ */
+static int __hed_nonull(1)
+repo_resize(struct hed_repo * repo, size_t size)
+{
+	hed_assert_intern(repo);
+	hed_assert_intern(repo->env);
+	hed_assert_intern(!repo->txn);
+	hed_assert_intern(size);
+
+	int ret;
+
+	if (repo->snap_nr)
+		return MDB_MAP_FULL;
+
+	ret = mdb_env_set_mapsize(repo->env, size);
+	if (ret)
+		return ret;
+
+	repo->conf.map_size = size;
+	repo->grow_nr++;
+
+	return 0;
+}
+
+/* Enlarge the map ahead of time, outside of any transaction. */
+static int __hed_nonull(1)
+repo_grow(struct hed_repo * repo)
+{
+	hed_assert_intern(repo);
+	hed_assert_intern(!repo->txn);
+
+	size_t size;
+	int ret;
+
+	ret = repo_grow_size(repo, false, &size);
+	if (ret || !size)
+		return ret;
+
+	pthread_mutex_lock(&repo->snap_lock);
+	ret = repo_resize(repo, size);
+	pthread_mutex_unlock(&repo->snap_lock);
+
+	return ret;
+}
+
+/*
+ * Grow a full map then replay the current write transaction from its log into
+ * a fresh one.
+ * When the map cannot grow, MDB_MAP_FULL is returned and the current
+ * transaction, if any, is left untouched so that the caller may roll back to a
+ * savepoint. Any other failure loses the transaction, which may then only be
+ * aborted.
+ */
+static int __hed_nonull(1)
+repo_regrow(struct hed_repo * repo)
+{
+	hed_assert_intern(repo);
+	hed_assert_intern(repo->log.on);
+
+	bool intact = !!repo->txn;
+	size_t size;
+	int ret;
+
+	do {
+		ret = repo_grow_size(repo, true, &size);
+		if (ret)
+			break;
+
+		/* Check snapshots before giving the transaction away. */
+		pthread_mutex_lock(&repo->snap_lock);
+		while (repo->copy_nr && (repo->snap_nr == repo->copy_nr))
+			/* Compaction copies complete on their own. */
+			pthread_cond_wait(&repo->snap_cond, &repo->snap_lock);
+		if (!repo->snap_nr) {
+			repo_txn_abort(repo);
+			intact = false;
+			ret = repo_resize(repo, size);
+		}
+		else
+			ret = MDB_MAP_FULL;
+		pthread_mutex_unlock(&repo->snap_lock);
+		if (ret)
+			break;
+
+		ret = mdb_txn_begin(repo->env, NULL, 0, &repo->txn);
+		if (ret) {
+			repo->txn = NULL;
+			break;
+		}
+
+		ret = repo_save_replay(repo, repo->save, repo->log.used);
+	} while (ret == MDB_MAP_FULL);
+
+	if (ret && !intact)
+		repo->log.lost = true;
+
+	return ret;
+}
+
+/* Change feed record header, followed by key bytes. */
+struct repo_feed_rec {
+	uint64_t commit;
+	uint32_t tbl;
+	uint16_t op;
+	uint16_t klen;
+};
+
+static void __hed_nonull(1, 3)
+repo_feed_copy_in(struct hed_repo_feed * feed,
+                  uint64_t pos,
+                  const void * src,
+                  size_t len)
+{
+	hed_assert_intern(feed);
+	hed_assert_intern(src || !len);
+	hed_assert_intern(len <= feed->size);
+
+	size_t off = (size_t)(pos % feed->size);
+	size_t part = stroll_min(len, feed->size - off);
+
+	memcpy(&feed->ring[off], src, part);
+	memcpy(feed->ring, &((const uint8_t *)src)[part], len - part);
+}
+
+static void __hed_nonull(1, 3)
+repo_feed_copy_out(const struct hed_repo_feed * feed,
+                   uint64_t pos,
+                   void * dst,
+                   size_t len)
+{
+	hed_assert_intern(feed);
+	hed_assert_intern(dst || !len);
+	hed_assert_intern(len <= feed->size);
+
+	size_t off = (size_t)(pos % feed->size);
+	size_t part = stroll_min(len, feed->size - off);
+
+	memcpy(dst, &feed->ring[off], part);
+	memcpy(&((uint8_t *)dst)[part], feed->ring, len - part);
+}
+
+/* Remember a key modified by the current write transaction. */
+static void __hed_nonull(1, 4)
+repo_feed_note(struct hed_repo * repo,
+               unsigned int tbl,
+               enum hed_repo_feed_op op,
+               const MDB_val * idx)
+{
+	hed_assert_intern(repo);
+	hed_assert_intern(tbl < repo->nb);
+	hed_assert_intern(idx);
+	hed_assert_intern(idx->mv_size <= HED_REPO_KEY_MAX);
+
+	struct hed_repo_feed *feed = &repo->feed;
+	struct repo_feed_rec rec = {
+		.commit = 0,
+		.tbl    = (uint32_t)tbl,
+		.op     = (uint16_t)op,
+		.klen   = (uint16_t)idx->mv_size
+	};
+	size_t sz = sizeof(rec) + idx->mv_size;
+
+	if (!feed->ring || feed->lost)
+		return;
+
+	if ((feed->used + sz) > feed->capa) {
+		size_t capa = stroll_max(2 * feed->capa, feed->used + sz);
+		uint8_t *pend;
+
+		pend = realloc(feed->pend, capa);
+		if (!pend) {
+			/* Never fail a write because of the feed. */
+			feed->lost = true;
+			return;
+		}
+
+		feed->pend = pend;
+		feed->capa = capa;
+	}
+
+	memcpy(&feed->pend[feed->used], &rec, sizeof(rec));
+	memcpy(&feed->pend[feed->used + sizeof(rec)], idx->mv_data,
+	       idx->mv_size);
+	feed->used += sz;
+}
+
+static void __hed_nonull(1, 2)
+repo_feed_push(struct hed_repo_feed * feed,
+               const struct repo_feed_rec * rec,
+               const uint8_t * key)
+{
+	hed_assert_intern(feed);
+	hed_assert_intern(rec);
+
+	size_t len = sizeof(*rec) + rec->klen;
+	struct repo_feed_rec old;
+
+	/* Make room by dropping oldest changes. */
+	while ((feed->head + len - feed->tail) > feed->size) {
+		repo_feed_copy_out(feed, feed->tail, &old, sizeof(old));
+		feed->tail += sizeof(old) + old.klen;
+	}
+
+	repo_feed_copy_in(feed, feed->head, rec, sizeof(*rec));
+	repo_feed_copy_in(feed, feed->head + sizeof(*rec), key, rec->klen);
+	feed->head += len;
+}
+
+static void __hed_nonull(1)
+repo_feed_discard(struct hed_repo_feed * feed)
+{
+	hed_assert_intern(feed);
+
+	feed->used = 0;
+	feed->lost = false;
+}
+
+/* Publish changes of the write transaction that just committed. */
+static void __hed_nonull(1)
+repo_feed_publish(struct hed_repo_feed * feed)
+{
+	hed_assert_intern(feed);
+
+	struct repo_feed_rec rec;
+	size_t off;
+
+	if (!feed->ring || (!feed->used && !feed->lost))
+		return;
+
+	pthread_mutex_lock(&feed->lock);
+
+	feed->commit++;
+	if (!feed->lost) {
+		for (off = 0; off < feed->used; off += sizeof(rec) + rec.klen) {
+			memcpy(&rec, &feed->pend[off], sizeof(rec));
+			rec.commit = feed->commit;
+			repo_feed_push(feed, &rec, &feed->pend[off + sizeof(rec)]);
+		}
+	}
+	else {
+		rec.commit = feed->commit;
+		rec.tbl = 0;
+		rec.op = HED_REPO_FEED_OVERFLOW;
+		rec.klen = 0;
+		repo_feed_push(feed, &rec, NULL);
+	}
+
+	pthread_mutex_unlock(&feed->lock);
+
+	eventfd_write(feed->fd, 1);
+
+	repo_feed_discard(feed);
+}
+
+static int __hed_nonull(1)
+repo_feed_init(struct hed_repo_feed * feed, size_t size)
+{
+	hed_assert_intern(feed);
+
+	int ret;
+
+	feed->pend = NULL;
+	feed->used = 0;
+	feed->capa = 0;
+	feed->lost = false;
+	feed->ring = NULL;
+	if (!size)
+		return 0;
+
+	feed->ring = malloc(size);
+	if (!feed->ring)
+		return -ENOMEM;
+
+	feed->fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (feed->fd < 0) {
+		ret = -errno;
+		goto free;
+	}
+
+	ret = -pthread_mutex_init(&feed->lock, NULL);
+	if (ret)
+		goto close;
+
+	feed->size = size;
+	feed->head = 0;
+	feed->tail = 0;
+	feed->commit = 0;
+
+	return 0;
+
+close:
+	close(feed->fd);
+free:
+	free(feed->ring);
+	feed->ring = NULL;
+	return ret;
+}
+
+static void __hed_nonull(1)
+repo_feed_fini(struct hed_repo_feed * feed)
+{
+	hed_assert_intern(feed);
+
+	free(feed->pend);
+	if (!feed->ring)
+		return;
+
+	pthread_mutex_destroy(&feed->lock);
+	close(feed->fd);
+	free(feed->ring);
+}
+
+/* Cached entry states. */
+#define REPO_CACHE_VALID (0U)
+/* Holds the committed object of a key the write transaction modified. */
+#define REPO_CACHE_STALE (1U)
+/* Holds no object: placeholder of a key the write transaction modified. */
+#define REPO_CACHE_HOLE  (2U)
+
+#define REPO_CACHE_BUCKET_NR (64U)
+
+struct repo_cache_ent {
+	struct repo_cache_ent *next;
+	struct repo_cache_ent *pend;
+	uint32_t               hash;
+	uint16_t               klen;
+	uint8_t                state;
+	bool                   ref;
+	uint8_t                data[];
+};
+
+struct hed_repo_cache {
+	struct repo_cache_ent       **bucket;
+	unsigned int                  bucket_nr;
+	unsigned int                  hand;
+	size_t                        obj_size;
+	hed_repo_decode_fn           *decode;
+	size_t                        budget;
+	struct repo_cache_ent        *pend;
+	bool                          bypass;
+	struct hed_repo_cache_stats   stats;
+};
+
+/* FNV-1a */
+static uint32_t __hed_nonull(1) __warn_result
+repo_cache_hash(const uint8_t * key, size_t klen)
+{
+	hed_assert_intern(key);
+
+	uint32_t hash = 2166136261U;
+	size_t i;
+
+	for (i = 0; i < klen; i++) {
+		hash ^= key[i];
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
+static size_t __hed_nonull(1, 2) __warn_result
+repo_cache_ent_size(const struct hed_repo_cache * cache,
+                    const struct repo_cache_ent * ent)
+{
+	hed_assert_intern(cache);
+	hed_assert_intern(ent);
+
+	return sizeof(*ent) + ent->klen +
+	       ((ent->state != REPO_CACHE_HOLE) ? cache->obj_size : 0);
+}
+
+static struct repo_cache_ent * __hed_nonull(1, 3) __warn_result
+repo_cache_find(const struct hed_repo_cache * cache,
+                uint32_t hash,
+                const MDB_val * idx)
+{
+	hed_assert_intern(cache);
+	hed_assert_intern(idx);
+
+	struct repo_cache_ent *ent;
+
+	for (ent = cache->bucket[hash & (cache->bucket_nr - 1)];
+	     ent;
+	     ent = ent->next) {
+		if ((ent->hash == hash) &&
+		    (ent->klen == idx->mv_size) &&
+		    !memcmp(ent->data, idx->mv_data, idx->mv_size))
+			return ent;
+	}
+
+	return NULL;
+}
+
+static void __hed_nonull(1, 2)
+repo_cache_unlink(struct hed_repo_cache * cache, struct repo_cache_ent * ent)
+{
+	hed_assert_intern(cache);
+	hed_assert_intern(ent);
+
+	struct repo_cache_ent **prev;
+
+	prev = &cache->bucket[ent->hash & (cache->bucket_nr - 1)];
+	while (*prev != ent)
+		prev = &(*prev)->next;
+	*prev = ent->next;
+
+	cache->stats.used -= repo_cache_ent_size(cache, ent);
+	cache->stats.nr--;
+	free(ent);
+}
+
+static void __hed_nonull(1)
+repo_cache_flush(struct hed_repo_cache * cache)
+{
+	hed_assert_intern(cache);
+
+	unsigned int b;
+	struct repo_cache_ent *ent;
+
+	for (b = 0; b < cache->bucket_nr; b++) {
+		while (cache->bucket[b]) {
+			ent = cache->bucket[b];
+			cache->bucket[b] = ent->next;
+			free(ent);
+		}
+	}
+
+	cache->pend = NULL;
+	cache->stats.used = 0;
+	cache->stats.nr = 0;
+}
+
+/* Double the number of buckets once chains average more than one entry. */
+static void __hed_nonull(1)
+repo_cache_rehash(struct hed_repo_cache * cache)
+{
+	hed_assert_intern(cache);
+
+	unsigned int nr = 2 * cache->bucket_nr;
+	struct repo_cache_ent **bucket;
+	struct repo_cache_ent *ent;
+	unsigned int b;
+
+	if (cache->stats.nr <= cache->bucket_nr)
+		return;
+
+	bucket = calloc(nr, sizeof(bucket[0]));
+	if (!bucket)
+		/* Longer chains only slow lookups down. */
+		return;
+
+	for (b = 0; b < cache->bucket_nr; b++) {
+		while (cache->bucket[b]) {
+			ent = cache->bucket[b];
+			cache->bucket[b] = ent->next;
+			ent->next = bucket[ent->hash & (nr - 1)];
+			bucket[ent->hash & (nr - 1)] = ent;
+		}
+	}
+
+	free(cache->bucket);
+	cache->bucket = bucket;
+	cache->bucket_nr = nr;
+	cache->hand = 0;
+}
+
+/*
+ * Make room for `size' bytes with the CLOCK algorithm, the hand sweeping
+ * buckets. Entries referenced since the last sweep get a second chance;
+ * entries pending invalidation are never evicted.
+ */
+static bool __hed_nonull(1) __warn_result
+repo_cache_evict(struct hed_repo_cache * cache, size_t size)
+{
+	hed_assert_intern(cache);
+
+	unsigned int sweep = 2 * cache->bucket_nr;
+	struct repo_cache_ent *ent;
+	struct repo_cache_ent *next;
+
+	if (size > cache->budget)
+		return false;
+
+	while ((cache->stats.used + size) > cache->budget) {
+		if (!sweep--)
+			return false;
+
+		for (ent = cache->bucket[cache->hand]; ent; ent = next) {
+			next = ent->next;
+			if (ent->state != REPO_CACHE_VALID)
+				continue;
+
+			if (ent->ref) {
+				ent->ref = false;
+				continue;
+			}
+
+			repo_cache_unlink(cache, ent);
+			cache->stats.evict++;
+		}
+
+		cache->hand = (cache->hand + 1) & (cache->bucket_nr - 1);
+	}
+
+	return true;
+}
+
+static struct repo_cache_ent * __hed_nonull(1, 3) __warn_result
+repo_cache_insert(struct hed_repo_cache * cache,
+                  uint32_t hash,
+                  const MDB_val * idx,
+                  const void * object)
+{
+	hed_assert_intern(cache);
+	hed_assert_intern(idx);
+	hed_assert_intern(idx->mv_size <= HED_REPO_KEY_MAX);
+
+	struct repo_cache_ent *ent;
+	size_t size = sizeof(*ent) + idx->mv_size +
+	              (object ? cache->obj_size : 0);
+	unsigned int b;
+
+	if (!repo_cache_evict(cache, size))
+		return NULL;
+
+	ent = malloc(size);
+	if (!ent)
+		return NULL;
+
+	ent->pend = NULL;
+	ent->hash = hash;
+	ent->klen = (uint16_t)idx->mv_size;
+	ent->state = object ? REPO_CACHE_VALID : REPO_CACHE_HOLE;
+	ent->ref = false;
+	memcpy(ent->data, idx->mv_data, idx->mv_size);
+	if (object)
+		memcpy(&ent->data[idx->mv_size], object, cache->obj_size);
+
+	b = hash & (cache->bucket_nr - 1);
+	ent->next = cache->bucket[b];
+	cache->bucket[b] = ent;
+	cache->stats.used += size;
+	cache->stats.nr++;
+
+	repo_cache_rehash(cache);
+
+	return ent;
+}
+
+/* Register a key the write transaction modified. */
+static void __hed_nonull(1, 2)
+repo_cache_mark(struct hed_repo_cache * cache, const MDB_val * idx)
+{
+	hed_assert_intern(cache);
+	hed_assert_intern(idx);
+
+	uint32_t hash = repo_cache_hash(idx->mv_data, idx->mv_size);
+	struct repo_cache_ent *ent;
+
+	ent = repo_cache_find(cache, hash, idx);
+	if (ent) {
+		if (ent->state != REPO_CACHE_VALID)
+			/* Already pending. */
+			return;
+
+		/* Committed objects must be hidden even while bypassing. */
+		ent->state = REPO_CACHE_STALE;
+	}
+	else {
+		if (cache->bypass)
+			/* Reads do not fill the cache: no placeholder needed. */
+			return;
+
+		ent = repo_cache_insert(cache, hash, idx, NULL);
+		if (!ent) {
+			/*
+			 * Without a placeholder, a later read could cache
+			 * uncommitted state: stop caching till transaction
+			 * end.
+			 */
+			cache->bypass = true;
+			return;
+		}
+	}
+
+	ent->pend = cache->pend;
+	cache->pend = ent;
+}
+
+/* Apply or drop invalidations once the write transaction ends. */
+static void __hed_nonull(1)
+repo_cache_settle(struct hed_repo_cache * cache, bool commit)
+{
+	hed_assert_intern(cache);
+
+	struct repo_cache_ent *ent;
+
+	while (cache->pend) {
+		ent = cache->pend;
+		cache->pend = ent->pend;
+		ent->pend = NULL;
+
+		if (commit || (ent->state == REPO_CACHE_HOLE)) {
+			if (ent->state == REPO_CACHE_STALE)
+				cache->stats.inval++;
+			repo_cache_unlink(cache, ent);
+		}
+		else
+			ent->state = REPO_CACHE_VALID;
+	}
+
+	cache->bypass = false;
+}
+
+static void __hed_nonull(1)
+repo_cache_settle_all(struct hed_repo * repo, bool commit)
+{
+	hed_assert_intern(repo);
+
+	size_t t;
+
+	if (!repo->cache)
+		return;
+
+	for (t = 0; t < repo->nb; t++) {
+		if (repo->cache[t])
+			repo_cache_settle(repo->cache[t], commit);
+	}
+}
+
+static void __hed_nonull(1)
+repo_cache_fini(struct hed_repo * repo)
+{
+	hed_assert_intern(repo);
+
+	size_t t;
+
+	if (!repo->cache)
+		return;
+
+	for (t = 0; t < repo->nb; t++) {
+		if (!repo->cache[t])
+			continue;
+
+		repo_cache_flush(repo->cache[t]);
+		free(repo->cache[t]->bucket);
+		free(repo->cache[t]);
+	}
+
+	free(repo->cache);
+	repo->cache = NULL;
+}
+
+/* Track a user table key modified by the write transaction. */
+static void __hed_nonull(1, 4)
+repo_note(struct hed_repo * repo,
+          unsigned int tbl,
+          enum hed_repo_feed_op op,
+          const MDB_val * idx)
+{
+	hed_assert_intern(repo);
+	hed_assert_intern(tbl < repo->nb);
+	hed_assert_intern(idx);
+
+	repo_feed_note(repo, tbl, op, idx);
+
+	if (repo->cache && repo->cache[tbl])
+		repo_cache_mark(repo->cache[tbl], idx);
+}
+
+/* Run a write operation, growing the map and replaying when it runs full. */
+static int __hed_nonull(1)
+repo_write(struct hed_repo * repo,
+           enum repo_log_op op,
+           unsigned int tbl,
+           MDB_val * idx,
+           MDB_val * content,
+           unsigned int flags)
+{
+	hed_assert_intern(repo);
+	hed_assert_intern(repo->txn || repo->log.lost);
+	hed_assert_intern(tbl < (repo->nb + REPO_META_NR));
+
+	size_t mark = repo->log.used;
+	int ret;
+
+	if (repo->log.lost)
+		return MDB_BAD_TXN;
+
+	if (!repo->log.on) {
+		ret = repo_apply(repo->txn, repo->dbi[tbl], op,
+		                 idx, content, flags);
+		goto out;
+	}
+
+	ret = repo_log_push(repo, op, tbl, idx, content, flags);
+	if (ret)
+		return ret;
+
+	ret = repo_apply(repo->txn, repo->dbi[tbl], op, idx, content, flags);
+	if ((ret == MDB_MAP_FULL) && !repo->log.cursor_nr) {
+		/* Replaying the log runs this operation again. */
+		ret = repo_regrow(repo);
+		if (!ret && (flags & MDB_RESERVE))
+			/* Locate space reserved by the replay, in place. */
+			ret = repo_apply(repo->txn, repo->dbi[tbl], op,
+			                 idx, content, flags);
+	}
+
+	if (ret)
+		repo->log.used = mark;
+
+out:
+	/*
+	 * Only user tables are accounted and published to the change feed:
+	 * secondary index entries merely mirror their primary table ones.
+	 */
+	if (!ret && (tbl < repo->nb) && !hed_repo_tbl_secondary(repo, tbl) &&
+	    (op != REPO_LOG_DROP)) {
+		if (op == REPO_LOG_PUT)
+			repo->cnt.put++;
+		else
+			repo->cnt.del++;
+		repo_note(repo, tbl,
+		          (op == REPO_LOG_PUT) ? HED_REPO_FEED_PUT :
+		                                 HED_REPO_FEED_DEL,
+		          idx);
+	}
+
+	return ret;
+}
+
+static int __hed_nonull(1, 3, 4)
+repo_put(struct hed_repo * repo,
+         unsigned int tbl,
+         MDB_val * idx,
+         MDB_val * content,
+         unsigned int flags)
+{
+	return repo_write(repo, REPO_LOG_PUT, tbl, idx, content, flags);
+}
+
+static int __hed_nonull(1, 3)
+repo_del(struct hed_repo * repo, unsigned int tbl, MDB_val * idx)
+{
+	return repo_write(repo, REPO_LOG_DEL, tbl, idx, NULL, 0);
+}
+
+static int __hed_nonull(1)
+repo_drop(struct hed_repo * repo, unsigned int tbl)
+{
+	return repo_write(repo, REPO_LOG_DROP, tbl, NULL, NULL, 0);
+}
+
+/* Tell whether user table `ix' is a secondary index of table `tbl'. */
+static bool __hed_nonull(1) __warn_result
+repo_index_of(const struct hed_repo * repo, unsigned int ix, unsigned int tbl)
+{
+	hed_assert_intern(repo);
+	hed_assert_intern(repo->desc);
+	hed_assert_intern(ix < repo->nb);
+
+	return repo->desc[ix].extract && (repo->desc[ix].primary == tbl);
+}
+
+/* Extract the index key of a primary entry, an empty one when not indexed. */
+static int __hed_nonull(1, 3, 5, 6)
+repo_index_key(const struct hed_repo * repo,
+               unsigned int ix,
+               const MDB_val * idx,
+               const MDB_val * content,
+               uint8_t * buf,
+               MDB_val * ikey)
+{
+	hed_assert_intern(repo);
+	hed_assert_intern(idx);
+	hed_assert_intern(buf);
+	hed_assert_intern(ikey);
+
+	ssize_t len = 0;
+
+	if (content) {
+		len = repo->desc[ix].extract(idx->mv_data, idx->mv_size,
+		                             content->mv_data,
+		                             content->mv_size,
+		                             buf);
+		if (len < 0)
+			return (int)len;
+		hed_assert_api(len <= HED_REPO_KEY_MAX);
+	}
+
+	ikey->mv_data = buf;
+	ikey->mv_size = (size_t)len;
+
+	return 0;
+}
+
+/*
+ * Maintain secondary indexes of table `tbl' for a write to key `idx'. Unless
+ * `fresh' is set, index keys of the current value are dropped; those of
+ * `content', if any, are added. Index entries left untouched by an update are
+ * not written.
+ */
+static int __hed_nonull(1, 3)
+repo_index_sync(struct hed_repo * repo,
+                unsigned int tbl,
+                MDB_val * idx,
+                const MDB_val * content,
+                bool fresh)
+{
+	hed_assert_intern(repo);
+	hed_assert_intern(repo->txn);
+	hed_assert_intern(idx);
+
+	uint8_t obuf[HED_REPO_KEY_MAX];
+	uint8_t nbuf[HED_REPO_KEY_MAX];
+	MDB_val okey;
+	MDB_val nkey;
+	MDB_val old;
+	unsigned int ix;
+	int ret;
+
+	if (!repo->index_nr)
+		return 0;
+
+	for (ix = 0; ix < repo->nb; ix++) {
+		if (!repo_index_of(repo, ix, tbl))
+			continue;
+
+		okey.mv_data = obuf;
+		okey.mv_size = 0;
+		if (!fresh) {
+			/* Writes to the previous index invalidate the value. */
+			ret = mdb_get(repo->txn, repo->dbi[tbl], idx, &old);
+			if (!ret)
+				ret = repo_index_key(repo, ix, idx, &old,
+				                     obuf, &okey);
+			else if (ret == MDB_NOTFOUND)
+				ret = 0;
+			if (ret)
+				return ret;
+		}
+
+		ret = repo_index_key(repo, ix, idx, content, nbuf, &nkey);
+		if (ret)
+			return ret;
+
+		if ((okey.mv_size == nkey.mv_size) &&
+		    !memcmp(okey.mv_data, nkey.mv_data, okey.mv_size))
+			continue;
+
+		if (okey.mv_size) {
+			ret = repo_write(repo, REPO_LOG_DEL, ix, &okey, idx, 0);
+			if (ret && (ret != MDB_NOTFOUND))
+				return ret;
+		}
+
+		if (nkey.mv_size) {
+			ret = repo_put(repo, ix, &nkey, idx, 0);
+			if (ret)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+/* Fill in secondary index `ix' from its primary table entries. */
+static int __hed_nonull(1)
+repo_index_build(struct hed_repo * repo, unsigned int ix)
+{
+	hed_assert_intern(repo);
+	hed_assert_intern(repo->txn);
+	hed_assert_intern(repo->desc[ix].extract);
+
+	uint8_t buf[HED_REPO_KEY_MAX];
+	unsigned int tbl = repo->desc[ix].primary;
+	MDB_cursor *cursor;
+	MDB_val idx;
+	MDB_val content;
+	MDB_val ikey;
+	MDB_stat stat;
+	int ret;
+
+	ret = mdb_stat(repo->txn, repo->dbi[ix], &stat);
+	if (ret || stat.ms_entries)
+		return ret;
+
+	ret = mdb_cursor_open(repo->txn, repo->dbi[tbl], &cursor);
+	if (ret)
+		return ret;
+
+	/* Primary pages are left untouched by index writes. */
+	ret = mdb_cursor_get(cursor, &idx, &content, MDB_FIRST);
+	while (!ret) {
+		ret = repo_index_key(repo, ix, &idx, &content, buf, &ikey);
+		if (!ret && ikey.mv_size)
+			ret = repo_put(repo, ix, &ikey, &idx, 0);
+		if (ret)
+			break;
+
+		ret = mdb_cursor_get(cursor, &idx, &content, MDB_NEXT);
+	}
+
+	mdb_cursor_close(cursor);
+
+	return (ret == MDB_NOTFOUND) ? 0 : ret;
+}
+
+static uint64_t __hed_nonull(1) __warn_result
+repo_elapsed_usec(const struct timespec * since)
+{
+	hed_assert_intern(since);
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return (uint64_t)((now.tv_sec - since->tv_sec) * 1000000L +
+	                  (now.tv_nsec - since->tv_nsec) / 1000L);
+}
+
+static void __hed_nonull(1)
+repo_count_get(struct hed_repo * repo, size_t nr)
+{
+	hed_assert_intern(repo);
+
+	/* Snapshots may be read from other threads. */
+	__atomic_fetch_add(&repo->cnt.get, (uint64_t)nr, __ATOMIC_RELAXED);
+}
+
+static void __hed_nonull(1, 2)
+repo_count_commit(struct hed_repo * repo, const struct timespec * start)
+{
+	hed_assert_intern(repo);
+	hed_assert_intern(start);
+
+	uint64_t lat = repo_elapsed_usec(start);
+	unsigned int b = 0;
+
+	while ((b < (HED_REPO_LAT_NR - 1)) && (lat >> b))
+		b++;
+
+	repo->cnt.commit++;
+	repo->cnt.commit_lat[b]++;
+}
+
+static void __hed_nonull(1)
+repo_count_hold(struct hed_repo * repo)
+{
+	hed_assert_intern(repo);
+
+	uint64_t hold;
+
+	if (!repo->timed)
+		return;
+
+	hold = repo_elapsed_usec(&repo->txn_start);
+	repo->cnt.hold_sum += hold;
+	repo->cnt.hold_max = stroll_max(repo->cnt.hold_max, hold);
+	repo->timed = false;
+}
+
+/* Start a top level transaction of the repo. */
+static int __hed_nonull(1)
+repo_begin(struct hed_repo * repo, unsigned int flags)
+{
+	hed_assert_intern(repo);
+	hed_assert_intern(repo->env);
+	hed_assert_intern(!repo->txn);
+
+	bool grow = !flags && repo->conf.map_max;
+	int ret;
+
+	if (grow) {
+		/* Grow ahead of time rather than replaying a transaction. */
+		ret = repo_grow(repo);
+		if (ret && (ret != MDB_MAP_FULL))
+			return ret;
+	}
+
+	ret = mdb_txn_begin(repo->env, NULL, flags, &repo->txn);
+	if (ret == MDB_MAP_RESIZED) {
+		/* Another process grew the map: adopt its size. */
+		ret = mdb_env_set_mapsize(repo->env, 0);
+		if (!ret)
+			ret = mdb_txn_begin(repo->env, NULL, flags, &repo->txn);
+	}
+	if (ret) {
+		repo->txn = NULL;
+		return ret;
+	}
+
+	repo_log_reset(repo, grow);
+
+#if defined(CONFIG_HED_REPO_3PC)
+	/* Only transactions started by hed_repo_start() are journaled. */
+	repo->undo = false;
+#endif
+
+	repo->timed = !flags;
+	if (repo->timed)
+		clock_gettime(CLOCK_MONOTONIC, &repo->txn_start);
+
+	return 0;
+}
+
+#if defined(CONFIG_HED_REPO_3PC)
+
+static int __hed_nonull(1, 3)
+repo_undo_record(struct hed_repo * repo, unsigned int tbl, MDB_val * idx)
+{
+	hed_assert_intern(repo);
+	hed_assert_intern(repo->txn);
+	hed_assert_intern(tbl < REPO_UNDO_TBL(repo));
+	hed_assert_intern(idx);
+
+	uint8_t buf[sizeof(uint16_t) + HED_REPO_KEY_MAX];
+	uint16_t id = (uint16_t)tbl;
+	int ret;
+	MDB_val old;
+	MDB_val content = {
+		.mv_data = NULL,
+		.mv_size = 0
+	};
+	MDB_val undo = {
+		.mv_data = buf,
+		.mv_size = sizeof(id) + idx->mv_size
+	};
+
+	/* HED_REPO_KEY_MAX leaves room for the table index prefix. */
+	if (idx->mv_size > HED_REPO_KEY_MAX)
+		return MDB_BAD_VALSIZE;
+
+	if (!repo->undo)
+		/* Internal transaction: never rolled back. */
+		return 0;
+
+	memcpy(buf, &id, sizeof(id));
+	memcpy(&buf[sizeof(id)], idx->mv_data, idx->mv_size);
+
+	/* Only the first modification of a key carries its pre-image. */
+	ret = mdb_get(repo->txn, repo->dbi[REPO_UNDO_TBL(repo)], &undo, &old);
+	if (ret != MDB_NOTFOUND)
+		return ret;
+
+	ret = mdb_get(repo->txn, repo->dbi[tbl], idx, &content);
+	if (ret && (ret != MDB_NOTFOUND))
+		return ret;
+
+	if (ret == MDB_NOTFOUND) {
+		content.mv_data = NULL;
+		content.mv_size = 0;
+	}
+
+	return repo_put(repo, REPO_UNDO_TBL(repo), &undo, &content, 0);
+}
+
+#endif /* defined(CONFIG_HED_REPO_3PC) */
+
+#define REPO_TTL_DEADLINE ((uint8_t)'d')
+#define REPO_TTL_ENTRY    ((uint8_t)'e')
+#define REPO_TTL_NAME     ((uint8_t)'n')
+
+/* Size of the tag, deadline and table index heading deadline keys. */
+#define REPO_TTL_HDR_SIZE \
+	(sizeof(uint8_t) + sizeof(uint64_t) + sizeof(uint16_t))
+
+static uint64_t __hed_nonull(1) __warn_result
+repo_ttl_msec(const struct timespec * time)
+{
+	hed_assert_intern(time);
+
+	if (time->tv_sec < 0)
+		return 0;
+
+	return ((uint64_t)time->tv_sec * 1000U) +
+	       ((uint64_t)time->tv_nsec / 1000000U);
+}
+
+/* Build an expiry table key into `buf', of REPO_TTL_HDR_SIZE + klen bytes. */
+static void __hed_nonull(1, 2, 6)
+repo_ttl_key(MDB_val * ttl,
+             uint8_t * buf,
+             uint8_t tag,
+             uint64_t deadline,
+             uint16_t id,
+             const MDB_val * idx)
+{
+	hed_assert_intern(ttl);
+	hed_assert_intern(buf);
+	hed_assert_intern(idx);
+	hed_assert_intern(idx->mv_size <= HED_REPO_TTL_KEY_MAX);
+
+	size_t off = 0;
+
+	id = htobe16(id);
+
+	buf[off++] = tag;
+	if (tag == REPO_TTL_DEADLINE) {
+		deadline = htobe64(deadline);
+		memcpy(&buf[off], &deadline, sizeof(deadline));
+		off += sizeof(deadline);
+	}
+	memcpy(&buf[off], &id, sizeof(id));
+	off += sizeof(id);
+	memcpy(&buf[off], idx->mv_data, idx->mv_size);
+
+	ttl->mv_data = buf;
+	ttl->mv_size = off + idx->mv_size;
+}
+
+static int __hed_nonull(1, 3)
+repo_ttl_write(struct hed_repo * repo,
+               enum repo_log_op op,
+               MDB_val * ttl,
+               MDB_val * content)
+{
+	hed_assert_intern(repo);
+	hed_assert_intern(repo->ttl_nr);
+	hed_assert_intern(ttl);
+
+#if defined(CONFIG_HED_REPO_3PC)
+	int ret;
+
+	ret = repo_undo_record(repo, REPO_TTL_TBL(repo), ttl);
+	if (ret)
+		return ret;
+#endif
+
+	return repo_write(repo, op, REPO_TTL_TBL(repo), ttl, content, 0);
+}
+
+/* Drop the deadline of a TTL table entry, if any. */
+static int __hed_nonull(1, 3)
+repo_ttl_clear(struct hed_repo * repo, unsigned int tbl, const MDB_val * idx)
+{
+	hed_assert_intern(repo);
+	hed_assert_intern(repo->txn);
+	hed_assert_intern(idx);
+
+	uint8_t buf[REPO_TTL_HDR_SIZE + HED_REPO_TTL_KEY_MAX];
+	uint64_t deadline;
+	MDB_val ttl;
+	MDB_val content;
+	int ret;
+
+	/* Longer keys are refused any deadline. */
+	if (idx->mv_size > HED_REPO_TTL_KEY_MAX)
+		return 0;
+
+	repo_ttl_key(&ttl, buf, REPO_TTL_ENTRY, 0, repo->ttl_id[tbl], idx);
+	ret = mdb_get(repo->txn, repo->dbi[REPO_TTL_TBL(repo)], &ttl, &content);
+	if (ret)
+		return (ret == MDB_NOTFOUND) ? 0 : ret;
+
+	hed_assert_intern(content.mv_size == sizeof(deadline));
+	memcpy(&deadline, content.mv_data, sizeof(deadline));
+
+	ret = repo_ttl_write(repo, REPO_LOG_DEL, &ttl, NULL);
+	if (ret)
+		return ret;
+
+	repo_ttl_key(&ttl, buf, REPO_TTL_DEADLINE, be64toh(deadline),
+	             repo->ttl_id[tbl], idx);
+
+	return repo_ttl_write(repo, REPO_LOG_DEL, &ttl, NULL);
+}
+
+/*
+ * Bind TTL tables to the identifiers their deadlines are recorded under,
+ * giving tables met for the first time the next free one. A read-only repo
+ * keeps new bindings in memory only: no deadline may be recorded anyway.
+ */
+static int __hed_nonull(1)
+repo_ttl_load(struct hed_repo * repo, bool rdonly)
+{
+	hed_assert_intern(repo);
+	hed_assert_intern(repo->txn);
+	hed_assert_intern(repo->ttl_nr);
+	hed_assert_intern(repo->ttl_id);
+
+	uint8_t buf[HED_REPO_KEY_MAX];
+	uint8_t tag = REPO_TTL_NAME;
+	MDB_dbi dbi = repo->dbi[REPO_TTL_TBL(repo)];
+	MDB_cursor *cursor;
+	MDB_val ttl;
+	MDB_val content;
+	uint16_t id;
+	uint32_t next = 0;
+	unsigned int t;
+	size_t len;
+	int ret;
+
+	ret = mdb_cursor_open(repo->txn, dbi, &cursor);
+	if (ret)
+		return ret;
+
+	ttl.mv_data = &tag;
+	ttl.mv_size = sizeof(tag);
+	for (ret = mdb_cursor_get(cursor, &ttl, &content, MDB_SET_RANGE);
+	     !ret && (((uint8_t *)ttl.mv_data)[0] == tag);
+	     ret = mdb_cursor_get(cursor, &ttl, &content, MDB_NEXT)) {
+		if (content.mv_size != sizeof(id)) {
+			ret = MDB_CORRUPTED;
+			break;
+		}
+
+		memcpy(&id, content.mv_data, sizeof(id));
+		next = stroll_max(next, (uint32_t)be16toh(id) + 1);
+	}
+
+	mdb_cursor_close(cursor);
+	if (ret && (ret != MDB_NOTFOUND))
+		return ret;
+
+	for (t = 0; t < repo->nb; t++) {
+		if (!hed_repo_tbl_ttl(repo, t))
+			continue;
+
+		len = strlen(repo->table[t]);
+		if (len >= sizeof(buf))
+			return MDB_BAD_VALSIZE;
+
+		buf[0] = tag;
+		memcpy(&buf[1], repo->table[t], len);
+		ttl.mv_data = buf;
+		ttl.mv_size = 1 + len;
+
+		ret = mdb_get(repo->txn, dbi, &ttl, &content);
+		if (!ret) {
+			if (content.mv_size != sizeof(id))
+				return MDB_CORRUPTED;
+
+			memcpy(&id, content.mv_data, sizeof(id));
+			repo->ttl_id[t] = be16toh(id);
+			continue;
+		}
+		if (ret != MDB_NOTFOUND)
+			return ret;
+
+		if (next > UINT16_MAX)
+			return -ENOSPC;
+
+		repo->ttl_id[t] = (uint16_t)next++;
+		if (rdonly)
+			continue;
+
+		id = htobe16(repo->ttl_id[t]);
+		content.mv_data = &id;
+		content.mv_size = sizeof(id);
+		ret = repo_put(repo, REPO_TTL_TBL(repo), &ttl, &content, 0);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* TTL table bound to an expiry table identifier, if any still is. */
+static int __hed_nonull(1) __warn_result
+repo_ttl_table(const struct hed_repo * repo, uint16_t id)
+{
+	hed_assert_intern(repo);
+	hed_assert_intern(repo->ttl_id);
+
+	unsigned int t;
+
+	for (t = 0; t < repo->nb; t++) {
+		if (hed_repo_tbl_ttl(repo, t) && (repo->ttl_id[t] == id))
+			return (int)t;
+	}
+
+	return -1;
+}
+
+/*
+ * Reserve the next block of sequence numbers of a table by raising its
+ * persisted high-water mark. This happens within the current write transaction
+ * if any, in a transaction of its own otherwise. In the former case, the block
+ * is usable only once the transaction commits, and is dropped on abort.
+ * The high-water mark is never journaled for rollback: sequence numbers may be
+ * skipped but never handed out twice.
+ */
+static int __hed_nonull(1)
+repo_seq_reserve(struct hed_repo * repo, unsigned int tbl)
+{
+	hed_assert_intern(repo);
+	hed_assert_intern(tbl < HED_REPO_META_TBL(repo));
+
+	struct hed_repo_seq *seq = &repo->seq[tbl];
+	const char *table = repo->table[tbl];
+	bool own = !repo->txn;
+	uint32_t hwm;
+	uint32_t last;
+	int ret;
+	MDB_val content;
+STROLL_IGNORE_WARN("-Wcast-qual")
+	MDB_val idx = {
+		.mv_data = (char *)table,
+		.mv_size = strlen(table)
+	};
+STROLL_RESTORE_WARN
+
+	if (own) {
+		ret = repo_begin(repo, 0);
+		if (ret)
+			return ret;
+	}
+
+	ret = mdb_get(repo->txn, repo->dbi[HED_REPO_META_TBL(repo)],
+	              &idx, &content);
+	if (ret)
+		goto abort;
+
+	hed_assert_api(content.mv_size == sizeof(hwm));
+	memcpy(&hwm, content.mv_data, sizeof(hwm));
+	if (hwm == UINT32_MAX) {
+		ret = -ENOSPC;
+		goto abort;
+	}
+
+	last = hwm + stroll_min((uint32_t)CONFIG_HED_REPO_SEQ_BLOCK,
+	                        UINT32_MAX - hwm);
+	content.mv_data = &last;
+	content.mv_size = sizeof(last);
+	ret = repo_put(repo, HED_REPO_META_TBL(repo), &idx, &content, 0);
+	if (ret)
+		goto abort;
+
+	if (own) {
+		ret = hed_repo_commit(repo);
+		if (ret)
+			return ret;
+	}
+	else
+		repo->seq_pending++;
+
+	seq->next = hwm + 1;
+	seq->last = last;
+	seq->pending = !own;
+	return 0;
+
+abort:
+	if (own)
+		hed_repo_abort(repo);
+	return ret;
+}
+
+/* Settle blocks reserved within the write transaction that just ended. */
+static void __hed_nonull(1)
+repo_seq_settle(struct hed_repo * repo, bool commit)
+{
+	hed_assert_intern(repo);
+
+	size_t i;
+
+	if (!repo->seq_pending)
+		return;
+
+	for (i = 0; i < repo->nb; i++) {
+		if (!repo->seq[i].pending)
+			continue;
+
+		repo->seq[i].pending = false;
+		if (!commit) {
+			repo->seq[i].next = 1;
+			repo->seq[i].last = 0;
+		}
+	}
+
+	repo->seq_pending = 0;
+}
+
+static void __hed_nonull(1)
+repo_seq_reset(struct hed_repo * repo)
+{
+	hed_assert_intern(repo);
+
+	size_t i;
+
+	for (i = 0; i < repo->nb; i++) {
+		repo->seq[i].next = 1;
+		repo->seq[i].last = 0;
+		repo->seq[i].pending = false;
+	}
+
+	repo->seq_pending = 0;
+}
+
+static int __hed_nonull(1)
+repo_open(struct hed_repo * repo, int flags)
+{
+	hed_assert_intern(repo);
+	hed_assert_intern(!repo->env);
+	hed_assert_intern(!repo->txn);
+
+	int ret;
+	unsigned int f = flags & O_RDONLY ? MDB_RDONLY : 0;
+	size_t i;
+	uint32_t seq = 0;
+
+	/* Blocks of sequence numbers are reserved again from persisted state. */
+	repo_seq_reset(repo);
+	repo_log_reset(repo, false);
+
+	ret = mdb_env_create(&repo->env);
+	if (ret)
+		return ret;
+
+	ret = mdb_env_set_maxdbs(repo->env, (MDB_dbi)(repo->nb + REPO_META_NR));
+	if (ret)
+		goto error;
+
+	if (repo->conf.map_size) {
+		ret = mdb_env_set_mapsize(repo->env, repo->conf.map_size);
+		if (ret)
+			goto error;
+	}
+
+	if (repo->conf.max_readers) {
+		ret = mdb_env_set_maxreaders(repo->env,
+		                             repo->conf.max_readers);
+		if (ret)
+			goto error;
+	}
+
+	ret = mdb_env_open(repo->env, stroll_lvstr_cstr(&repo->path),
+			   f | MDB_NOSUBDIR | MDB_NOTLS |
+			   repo_env_flags(&repo->conf),
+			   repo->mode);
+	if (ret)
+		goto error;
+
+	ret = mdb_txn_begin(repo->env, NULL, f, &repo->txn);
+	if (ret)
+		goto error;
+
+	ret = repo_open_table(repo, ".hed", flags, 0,
+	                      &repo->dbi[HED_REPO_META_TBL(repo)]);
+	if (ret)
+		goto error;
+
+	if (repo->ttl_nr) {
+		/* Expiry may be enabled onto tables of an existing repo. */
+		ret = repo_open_table(repo, ".ttl",
+		                      (flags & O_RDWR) ? (flags | O_CREAT) :
+		                                         flags,
+		                      0,
+		                      &repo->dbi[REPO_TTL_TBL(repo)]);
+		if (ret)
+			goto error;
+
+		ret = repo_ttl_load(repo, !!f);
+		if (ret)
+			goto error;
+	}
+
+#if defined(CONFIG_HED_REPO_3PC)
+	/*
+	 * Opening starts from an empty journal, just like hed_repo_start()
+	 * does: there is nothing to rollback until the next transaction.
+	 */
+	ret = repo_open_table(repo, ".undo",
+	                      f ? 0 : (O_CREAT | O_TRUNC), 0,
+	                      &repo->dbi[REPO_UNDO_TBL(repo)]);
+	if (ret)
+		goto error;
+#endif
+
+	for (i = 0; i < repo->nb; i++) {
+		hed_assert_api(repo->table[i]);
+		hed_assert_api(repo->table[i][0] != '.');
+
+		ret = repo_open_table(repo, repo->table[i], flags,
+		                      repo->desc ? repo->desc[i].flags : 0,
+		                      &repo->dbi[i]);
+		if (ret)
+			goto error;
+	}
+
+	if (repo->index_nr && (flags & O_RDWR)) {
+		for (i = 0; i < repo->nb; i++) {
+			if (!repo->desc[i].extract)
+				continue;
+
+			ret = repo_index_build(repo, (unsigned int)i);
+			if (ret)
+				goto error;
+		}
+	}
+
+	if (flags & O_TRUNC) {
+		for (i = 0; i < repo->nb; i++) {
+			ret = hed_repo_tbl_update(repo, HED_REPO_META_TBL(repo),
+				(const uint8_t *)repo->table[i],
+				strlen(repo->table[i]),
+				(const uint8_t *)&seq, sizeof(seq));
+			if (ret)
+				goto error;
+		}
+	}
+
+	/* Table handles become valid for the whole env lifetime once committed. */
+	ret = hed_repo_commit(repo);
+	if (ret)
+		goto error;
+
+	if (repo->conf.sync_period)
+		etux_timer_arm_msec(&repo->sync_timer, repo->conf.sync_period);
+
+	return 0;
+error:
+	repo_close(repo);
+	return ret;
+}
+
+static int
+repo_init(struct hed_repo                *repo,
+          const char                     *path,
+          const char * const             *table,
+          const struct hed_repo_tbl_desc *desc,
+          size_t                          nb,
+          int                             flags,
+          mode_t                          mode,
+          const struct hed_repo_conf     *conf)
+{
+	hed_assert_api(repo);
+	hed_assert_api(path);
+	hed_assert_api(strlen(path) > 0);
+	hed_assert_api(!(flags & (~(O_RDWR | O_RDONLY | O_CREAT | O_TRUNC))));
+	hed_assert_api(!(flags & O_CREAT) | (flags & O_RDWR));
+	hed_assert_api(!(flags & O_TRUNC) | (flags & O_CREAT));
+	hed_assert_api(!conf || (conf->sync_period >= 0));
+	hed_assert_api(!conf || (conf->durability >= HED_REPO_SYNC));
+	hed_assert_api(!conf || (conf->durability <= HED_REPO_NOSYNC));
+	hed_assert_api(!conf || !conf->map_max ||
+	               (conf->map_max >= conf->map_size));
+	hed_assert_api(!conf || !conf->feed_size ||
+	               (conf->feed_size >= (sizeof(struct repo_feed_rec) +
+	                                    HED_REPO_KEY_MAX)));
+
+
+	size_t i;
+	int ret;
+
+	repo->conf = conf ? *conf : repo_dflt_conf;
+	etux_timer_init(&repo->sync_timer, repo_sync_expire);
+
+	repo->env = NULL;
+	repo->txn = NULL;
+	repo->snap_pool = NULL;
+	repo->snap_nr = 0;
+	repo->copy_nr = 0;
+	repo->log.data = NULL;
+	repo->log.capa = 0;
+	repo->save = NULL;
+	repo->desc = desc;
+	repo->index_nr = 0;
+	repo->ttl_nr = 0;
+	for (i = 0; desc && (i < nb); i++) {
+		if (desc[i].extract)
+			repo->index_nr++;
+		if (desc[i].flags & HED_REPO_TBL_TTL)
+			repo->ttl_nr++;
+	}
+	repo->grow_nr = 0;
+	repo->cache = NULL;
+	repo->timed = false;
+#if defined(CONFIG_HED_REPO_3PC)
+	repo->undo = false;
+#endif
+	memset(&repo->cnt, 0, sizeof(repo->cnt));
+
+STROLL_IGNORE_WARN("-Wcast-qual")
+	*(int *)&repo->flags = flags & O_ACCMODE;
+	*(mode_t *)&repo->mode = mode;
+	*(char  ***)&repo->table = (char **)table;
+	*(size_t *)&repo->nb = nb;
+STROLL_RESTORE_WARN
+
+	ret = stroll_lvstr_init_dup(&repo->path, path);
+	if (ret)
+		return ret;
+
+	repo->dbi = malloc((nb + REPO_META_NR) * sizeof(*repo->dbi));
+	if (!repo->dbi) {
+		ret = -ENOMEM;
+		goto free_path;
+	}
+
+	repo->seq = malloc(nb * sizeof(*repo->seq));
+	if (nb && !repo->seq) {
+		ret = -ENOMEM;
+		goto free_dbi;
+	}
+
+	repo->ttl_id = NULL;
+	if (repo->ttl_nr) {
+		repo->ttl_id = malloc(nb * sizeof(*repo->ttl_id));
+		if (!repo->ttl_id) {
+			ret = -ENOMEM;
+			goto free_seq;
+		}
+	}
+
+	ret = -pthread_mutex_init(&repo->snap_lock, NULL);
+	if (ret)
+		goto free_ttl;
+
+	ret = -pthread_cond_init(&repo->snap_cond, NULL);
+	if (ret)
+		goto destroy_lock;
+
+	ret = repo_feed_init(&repo->feed, repo->conf.feed_size);
+	if (ret)
+		goto destroy_cond;
+
+	ret = repo_open(repo, flags);
+	if (ret)
+		goto fini_feed;
+
+	return 0;
+
+fini_feed:
+	repo_feed_fini(&repo->feed);
+destroy_cond:
+	pthread_cond_destroy(&repo->snap_cond);
+destroy_lock:
+	pthread_mutex_destroy(&repo->snap_lock);
+	free(repo->log.data);
+free_ttl:
+	free(repo->ttl_id);
+free_seq:
+	free(repo->seq);
+free_dbi:
+	free(repo->dbi);
+free_path:
+	stroll_lvstr_fini(&repo->path);
+	return ret;
+}
+
+int
+hed_repo_open(struct hed_repo    *repo,
+              const char         *path,
+              const char * const *table,
+              size_t              nb,
+              int                 flags,
+              mode_t              mode)
+{
+	return hed_repo_open_conf(repo, path, table, nb, flags, mode, NULL);
+}
+
+int
+hed_repo_open_conf(struct hed_repo             *repo,
+                   const char                  *path,
+                   const char * const          *table,
+                   size_t                       nb,
+                   int                          flags,
+                   mode_t                       mode,
+                   const struct hed_repo_conf  *conf)
+{
+	return repo_init(repo, path, table, NULL, nb, flags, mode, conf);
+}
+
+int
+hed_repo_open_desc(struct hed_repo                *repo,
+                   const char                     *path,
+                   const struct hed_repo_tbl_desc *desc,
+                   size_t                          nb,
+                   int                             flags,
+                   mode_t                          mode,
+                   const struct hed_repo_conf     *conf)
+{
+	hed_assert_api(repo);
+	hed_assert_api(desc || !nb);
+
+	const char **table;
+	size_t i;
+	int ret;
+
+	table = malloc(nb * sizeof(table[0]));
+	if (nb && !table)
+		return -ENOMEM;
+
+	for (i = 0; i < nb; i++) {
+		hed_assert_api(desc[i].name);
+		hed_assert_api(!(desc[i].flags &
+		                 ~(HED_REPO_TBL_INTKEY | HED_REPO_TBL_DUP |
+		                   HED_REPO_TBL_TTL)));
+		hed_assert_api(!(desc[i].flags & HED_REPO_TBL_TTL) ||
+		               (!(desc[i].flags & HED_REPO_TBL_DUP) &&
+		                !desc[i].extract));
+		/* Index tables map index keys to primary ones. */
+		hed_assert_api(!desc[i].extract ||
+		               ((desc[i].flags & HED_REPO_TBL_DUPSORT) &&
+		                (desc[i].primary < nb) &&
+		                !desc[desc[i].primary].extract &&
+		                !(desc[desc[i].primary].flags &
+		                  HED_REPO_TBL_DUP)));
+
+#if defined(CONFIG_HED_REPO_3PC)
+		/* Pre-images journaling keeps a single value per key. */
+		if (desc[i].flags & HED_REPO_TBL_DUP) {
+			free(table);
+			return -ENOTSUP;
+		}
+#endif
+
+		table[i] = desc[i].name;
+	}
+
+	ret = repo_init(repo, path, table, desc, nb, flags, mode, conf);
+	if (ret)
+		free(table);
+
+	return ret;
+}
+
+/* Release everything hed_repo_open() allocated but the environment. */
+static void __hed_nonull(1)
+repo_fini(struct hed_repo * repo)
+{
+	hed_assert_intern(repo);
+	hed_assert_intern(!repo->env);
+
+	repo_cache_fini(repo);
+	repo_feed_fini(&repo->feed);
+	pthread_cond_destroy(&repo->snap_cond);
+	pthread_mutex_destroy(&repo->snap_lock);
+	free(repo->log.data);
+	free(repo->ttl_id);
+	free(repo->seq);
+	free(repo->dbi);
+STROLL_IGNORE_WARN("-Wcast-qual")
+	if (repo->desc)
+		/* Table names array built by hed_repo_open_desc(). */
+		free((void *)repo->table);
+STROLL_RESTORE_WARN
+	stroll_lvstr_fini(&repo->path);
+}
+
+int
+hed_repo_close(struct hed_repo * repo)
+{
+	hed_assert_api(repo);
+
+	if (!repo->env)
+		return 0;
+
+	/* Pooled transactions of live snapshots must not outlive the env. */
+	if (repo_snap_busy(repo))
+		return -EBUSY;
+
+	repo_close(repo);
+	repo_fini(repo);
+
+	return 0;
+}
+
+int
+hed_repo_reload(struct hed_repo * repo)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(!repo->txn);
+
+	size_t t;
+
+	if (repo_snap_busy(repo))
+		return -EBUSY;
+
+	/* Content may have changed behind our back. */
+	if (repo->cache) {
+		for (t = 0; t < repo->nb; t++) {
+			if (repo->cache[t])
+				repo_cache_flush(repo->cache[t]);
+		}
+	}
+
+	repo_close(repo);
+	return repo_open(repo, repo->flags);
+}
+
+/*
+ * Count pages of the freelist, i.e. LMDB's internal table 0 whose records are
+ * lists of page numbers prefixed by their count.
+ */
+static int __hed_nonull(1, 2)
+repo_free_pages(MDB_env * env, size_t * pages)
+{
+	hed_assert_intern(env);
+	hed_assert_intern(pages);
+
+	MDB_txn *txn;
+	MDB_cursor *cursor;
+	MDB_val idx;
+	MDB_val content;
+	size_t cnt;
+	size_t nr = 0;
+	int ret;
+
+	ret = mdb_txn_begin(env, NULL, MDB_RDONLY, &txn);
+	if (ret)
+		return ret;
+
+	ret = mdb_cursor_open(txn, 0, &cursor);
+	if (ret)
+		goto abort;
+
+	ret = mdb_cursor_get(cursor, &idx, &content, MDB_FIRST);
+	while (!ret) {
+		hed_assert_intern(content.mv_size >= sizeof(cnt));
+
+		memcpy(&cnt, content.mv_data, sizeof(cnt));
+		nr += cnt;
+
+		ret = mdb_cursor_get(cursor, &idx, &content, MDB_NEXT);
+	}
+
+	mdb_cursor_close(cursor);
+	if (ret == MDB_NOTFOUND) {
+		*pages = nr;
+		ret = 0;
+	}
+
+abort:
+	mdb_txn_abort(txn);
+
+	return ret;
+}
+
+static int __hed_nonull(1, 2, 3)
+repo_file_info(MDB_env * env, const char * path, size_t * size, size_t * pages)
+{
+	hed_assert_intern(env);
+	hed_assert_intern(path);
+	hed_assert_intern(size);
+	hed_assert_intern(pages);
+
+	struct stat st;
+
+	if (stat(path, &st))
+		return -errno;
+
+	*size = (size_t)st.st_size;
+
+	return repo_free_pages(env, pages);
+}
+
+static void *
+repo_compact_run(void * arg)
+{
+	hed_assert_intern(arg);
+
+	struct hed_repo_compact *cpt = arg;
+	struct hed_repo *repo = cpt->repo;
+
+	cpt->status = mdb_env_copy2(repo->env, cpt->path, MDB_CP_COMPACT);
+
+	/* Let map growth proceed. */
+	pthread_mutex_lock(&repo->snap_lock);
+	repo->snap_nr--;
+	repo->copy_nr--;
+	pthread_cond_broadcast(&repo->snap_cond);
+	pthread_mutex_unlock(&repo->snap_lock);
+
+	return NULL;
+}
+
+/* Copy the repo from a background thread. */
+static int __hed_nonull(1)
+repo_compact_copy(struct hed_repo_compact * cpt)
+{
+	hed_assert_intern(cpt);
+	hed_assert_intern(cpt->repo);
+	hed_assert_intern(cpt->path);
+
+	struct hed_repo *repo = cpt->repo;
+	int ret;
+
+	unlink(cpt->path);
+	cpt->status = 0;
+
+	/*
+	 * The copy runs a read transaction: account for it like a snapshot so
+	 * that the map is not resized under its feet.
+	 */
+	pthread_mutex_lock(&repo->snap_lock);
+	repo->snap_nr++;
+	repo->copy_nr++;
+	pthread_mutex_unlock(&repo->snap_lock);
+
+	ret = -pthread_create(&cpt->thread, NULL, repo_compact_run, cpt);
+	if (ret) {
+		pthread_mutex_lock(&repo->snap_lock);
+		repo->snap_nr--;
+		repo->copy_nr--;
+		pthread_mutex_unlock(&repo->snap_lock);
+	}
+
+	return ret;
+}
+
+int
+hed_repo_compact_start(struct hed_repo_compact * cpt, struct hed_repo * repo)
+{
+	hed_assert_api(cpt);
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+
+	const char *path = stroll_lvstr_cstr(&repo->path);
+	size_t len = strlen(path);
+	MDB_envinfo info;
+	int ret;
+
+	ret = mdb_env_info(repo->env, &info);
+	if (ret)
+		return ret;
+
+	cpt->path = malloc(len + sizeof(".compact"));
+	if (!cpt->path)
+		return -ENOMEM;
+
+	memcpy(cpt->path, path, len);
+	memcpy(&cpt->path[len], ".compact", sizeof(".compact"));
+
+	cpt->repo = repo;
+	cpt->txnid = info.me_last_txnid;
+
+	ret = repo_compact_copy(cpt);
+	if (ret)
+		free(cpt->path);
+
+	return ret;
+}
+
+int
+hed_repo_compact_end(struct hed_repo_compact * cpt,
+                     struct hed_repo_compact_info * info)
+{
+	hed_assert_api(cpt);
+	hed_assert_api(cpt->repo);
+	hed_assert_api(cpt->repo->env);
+	hed_assert_api(!cpt->repo->txn);
+
+	struct hed_repo *repo = cpt->repo;
+	const char *path = stroll_lvstr_cstr(&repo->path);
+	struct hed_repo_compact_info res;
+	MDB_envinfo env;
+	MDB_txn *txn = NULL;
+	struct stat st;
+	bool swapped = false;
+	int ret;
+	int err;
+
+	pthread_join(cpt->thread, NULL);
+
+	ret = cpt->status;
+	if (ret)
+		goto unlink;
+
+	if (repo_snap_busy(repo)) {
+		ret = -EBUSY;
+		goto unlink;
+	}
+
+	ret = repo_file_info(repo->env, path, &res.size_before,
+	                     &res.free_before);
+	if (ret)
+		goto unlink;
+
+	ret = mdb_env_info(repo->env, &env);
+	if (ret)
+		goto unlink;
+
+	if (env.me_last_txnid != cpt->txnid) {
+		/*
+		 * Writes committed during the copy would be lost: copy again
+		 * while holding the writer lock, up to the swap.
+		 */
+		ret = mdb_txn_begin(repo->env, NULL, 0, &txn);
+		if (ret)
+			goto unlink;
+
+		ret = repo_compact_copy(cpt);
+		if (!ret) {
+			pthread_join(cpt->thread, NULL);
+			ret = cpt->status;
+		}
+		if (ret) {
+			mdb_txn_abort(txn);
+			goto unlink;
+		}
+	}
+
+	/* Atomically replace the database file. */
+	if (!rename(cpt->path, path)) {
+		swapped = true;
+		res.size_after = 0;
+		res.free_after = 0;
+		if (!stat(path, &st))
+			res.size_after = (size_t)st.st_size;
+		else
+			ret = -errno;
+	}
+	else {
+		ret = -errno;
+		unlink(cpt->path);
+	}
+
+	if (txn)
+		mdb_txn_abort(txn);
+	repo_close(repo);
+
+	err = repo_open(repo, repo->flags);
+	if (err) {
+		/*
+		 * No environment left to work with: release everything else
+		 * so that the repo is left in the same state as once closed.
+		 */
+		repo_fini(repo);
+		ret = -ENOTRECOVERABLE;
+	}
+	else if (swapped) {
+		err = repo_free_pages(repo->env, &res.free_after);
+		if (!ret)
+			ret = err;
+	}
+
+	/* The swap took place: report sizes whatever happened next. */
+	if (swapped && info)
+		*info = res;
+
+	free(cpt->path);
+
+	return ret;
+
+unlink:
+	unlink(cpt->path);
+	free(cpt->path);
+
+	return ret;
+}
+
+void
+hed_repo_sub_init(struct hed_repo_sub * sub, struct hed_repo * repo)
+{
+	hed_assert_api(sub);
+	hed_assert_api(repo);
+	hed_assert_api(repo->feed.ring);
+
+	sub->repo = repo;
+
+	/* Subscribers start with changes committed from now on. */
+	pthread_mutex_lock(&repo->feed.lock);
+	sub->pos = repo->feed.head;
+	pthread_mutex_unlock(&repo->feed.lock);
+}
+
+int
+hed_repo_feed_read(struct hed_repo_sub * sub, struct hed_repo_change * chg)
+{
+	hed_assert_api(sub);
+	hed_assert_api(sub->repo);
+	hed_assert_api(sub->repo->feed.ring);
+	hed_assert_api(chg);
+
+	struct hed_repo_feed *feed = &sub->repo->feed;
+	struct repo_feed_rec rec;
+
+	pthread_mutex_lock(&feed->lock);
+
+	if (sub->pos < feed->tail) {
+		/* Changes were dropped before we could read them. */
+		rec.commit = feed->commit;
+		rec.tbl = 0;
+		rec.op = HED_REPO_FEED_OVERFLOW;
+		rec.klen = 0;
+		sub->pos = feed->head;
+	}
+	else if (sub->pos == feed->head) {
+		pthread_mutex_unlock(&feed->lock);
+		return -EAGAIN;
+	}
+	else {
+		repo_feed_copy_out(feed, sub->pos, &rec, sizeof(rec));
+		repo_feed_copy_out(feed, sub->pos + sizeof(rec), sub->key,
+		                   rec.klen);
+		sub->pos += sizeof(rec) + rec.klen;
+	}
+
+	pthread_mutex_unlock(&feed->lock);
+
+	chg->commit = rec.commit;
+	chg->tbl = rec.tbl;
+	chg->op = (enum hed_repo_feed_op)rec.op;
+	chg->key = rec.klen ? sub->key : NULL;
+	chg->klen = rec.klen;
+
+	return 0;
+}
+
+void
+hed_repo_feed_clear(struct hed_repo * repo)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->feed.ring);
+
+	eventfd_t cnt;
+
+	eventfd_read(repo->feed.fd, &cnt);
+}
+
+int
+hed_repo_get_map_info(struct hed_repo * repo,
+                      struct hed_repo_map_info * info)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(info);
+
+	MDB_envinfo env;
+	MDB_stat stat;
+	int ret;
+
+	ret = mdb_env_info(repo->env, &env);
+	if (ret)
+		return ret;
+
+	ret = mdb_env_stat(repo->env, &stat);
+	if (ret)
+		return ret;
+
+	info->size = env.me_mapsize;
+	info->used = (env.me_last_pgno + 1) * stat.ms_psize;
+	info->grow_nr = repo->grow_nr;
+
+	return 0;
+}
+
+/*
+ * mdb_reader_list() callback, given one line per used reader slot along with
+ * a header. Slots of reset transactions show no transaction ID.
+ */
+static int __hed_nonull(1, 2)
+repo_count_reader(const char * msg, void * ctx)
+{
+	hed_assert_intern(msg);
+	hed_assert_intern(ctx);
+
+	unsigned int *nr = ctx;
+	size_t len = strlen(msg);
+	unsigned long pid;
+	char *end;
+
+	pid = strtoul(msg, &end, 10);
+	if (!pid || (end == msg))
+		/* Header or "(no active readers)". */
+		return 0;
+
+	if ((len >= 2) && !strcmp(&msg[len - 2], "-\n"))
+		return 0;
+
+	(*nr)++;
+
+	return 0;
+}
+
+int
+hed_repo_get_stats(struct hed_repo * repo, struct hed_repo_stats * stats)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(stats);
+
+	MDB_envinfo env;
+	MDB_stat stat;
+	int ret;
+
+	ret = mdb_env_info(repo->env, &env);
+	if (ret)
+		return ret;
+
+	ret = mdb_env_stat(repo->env, &stat);
+	if (ret)
+		return ret;
+
+	ret = repo_free_pages(repo->env, &stats->free_pages);
+	if (ret)
+		return ret;
+
+	stats->readers = 0;
+	ret = mdb_reader_list(repo->env, repo_count_reader, &stats->readers);
+	if (ret < 0)
+		return ret;
+
+	stats->map_size = env.me_mapsize;
+	stats->map_used = (env.me_last_pgno + 1) * stat.ms_psize;
+	stats->page_size = stat.ms_psize;
+	stats->last_txnid = env.me_last_txnid;
+	stats->max_readers = env.me_maxreaders;
+	stats->cnt = repo->cnt;
+	stats->cnt.get = __atomic_load_n(&repo->cnt.get, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+int
+hed_repo_get_tbl_stats(struct hed_repo * repo,
+                       unsigned int tbl,
+                       struct hed_repo_tbl_stats * stats)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(tbl <= HED_REPO_META_TBL(repo));
+	hed_assert_api(stats);
+
+	MDB_txn *txn = repo->txn;
+	MDB_stat stat;
+	int ret;
+
+	if (!txn) {
+		ret = mdb_txn_begin(repo->env, NULL, MDB_RDONLY, &txn);
+		if (ret)
+			return ret;
+	}
+
+	ret = mdb_stat(txn, repo->dbi[tbl], &stat);
+
+	if (txn != repo->txn)
+		mdb_txn_abort(txn);
+
+	if (ret)
+		return ret;
+
+	stats->entries = stat.ms_entries;
+	stats->depth = stat.ms_depth;
+	stats->branch_pages = stat.ms_branch_pages;
+	stats->leaf_pages = stat.ms_leaf_pages;
+	stats->overflow_pages = stat.ms_overflow_pages;
+	stats->bytes = (stat.ms_branch_pages + stat.ms_leaf_pages +
+	                stat.ms_overflow_pages) * stat.ms_psize;
+
+	return 0;
+}
+
+void
+hed_repo_reset_counters(struct hed_repo * repo)
+{
+	hed_assert_api(repo);
+
+	memset(&repo->cnt, 0, sizeof(repo->cnt));
+}
+
+int
+hed_repo_start(struct hed_repo * repo)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(!repo->txn);
+
+	unsigned int flags = repo->flags & O_RDONLY ? MDB_RDONLY : 0;
+
+#if defined(CONFIG_HED_REPO_3PC)
+	int ret;
+
+	ret = repo_begin(repo, flags);
+	if (ret || flags)
+		return ret;
+
+	/* Forget about the previous transaction pre-images. */
+	ret = repo_drop(repo, REPO_UNDO_TBL(repo));
+	if (ret) {
+		hed_repo_abort(repo);
+		return ret;
+	}
+
+	repo->undo = true;
+
+	return 0;
+#else
+	return repo_begin(repo, flags);
+#endif
+}
+
+int
+hed_repo_commit(struct hed_repo * repo)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(repo->txn || repo->log.lost);
+	hed_assert_api(!repo->save);
+
+	struct timespec start;
+	int ret;
+
+	if (repo->log.lost) {
+		hed_repo_abort(repo);
+		return MDB_BAD_TXN;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	ret = mdb_txn_commit(repo->txn);
+	repo->txn = NULL;
+	while ((ret == MDB_MAP_FULL) && repo->log.on) {
+		/* The failed commit released the transaction: replay it all. */
+		ret = repo_regrow(repo);
+		if (ret) {
+			if (repo->txn) {
+				mdb_txn_abort(repo->txn);
+				repo->txn = NULL;
+			}
+			break;
+		}
+
+		ret = mdb_txn_commit(repo->txn);
+		repo->txn = NULL;
+	}
+
+	if (!ret)
+		repo_count_commit(repo, &start);
+	else
+		repo->cnt.abort++;
+	repo_count_hold(repo);
+
+#if defined(CONFIG_HED_REPO_3PC)
+	/*
+	 * Internal transactions (own sequence reservations, opening, rollback)
+	 * are not journaled and the journal left over by a failed commit holds
+	 * the previous transaction pre-images: neither may be rolled back.
+	 */
+	repo->undo = repo->undo && !ret;
+#endif
+
+	repo_log_reset(repo, false);
+	repo_seq_settle(repo, !ret);
+	repo_cache_settle_all(repo, !ret);
+	if (!ret)
+		repo_feed_publish(&repo->feed);
+	else
+		repo_feed_discard(&repo->feed);
+	return ret;
+}
+
+void
+hed_repo_abort(struct hed_repo * repo)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(repo->txn || repo->log.lost);
+
+	/* A transaction lost while growing the map is already released. */
+	repo_txn_abort(repo);
+	repo->save = NULL;
+
+	repo->cnt.abort++;
+	repo_count_hold(repo);
+
+#if defined(CONFIG_HED_REPO_3PC)
+	/* The journal reset was aborted along. */
+	repo->undo = false;
+#endif
+
+	repo_log_reset(repo, false);
+	repo_seq_settle(repo, false);
+	repo_cache_settle_all(repo, false);
+	repo_feed_discard(&repo->feed);
+}
+
+int
+hed_repo_save_begin(struct hed_repo * repo, struct hed_repo_save * save)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(repo->txn);
+	hed_assert_api(!repo->log.lost);
+	hed_assert_api(save);
+
+	int ret;
+
+	/*
+	 * LMDB does not nest transactions of MDB_WRITEMAP environments, which
+	 * HED_REPO_MAPASYNC durability implies.
+	 */
+	if (repo_env_flags(&repo->conf) & MDB_WRITEMAP)
+		return -ENOTSUP;
+
+	save->parent = repo->txn;
+	ret = mdb_txn_begin(repo->env, save->parent, 0, &repo->txn);
+	if (ret) {
+		repo->txn = save->parent;
+		return ret;
+	}
+
+	save->prev = repo->save;
+	save->log_mark = repo->log.used;
+	save->feed_mark = repo->feed.used;
+	save->feed_lost = repo->feed.lost;
+	save->seq_pending = repo->seq_pending;
+	repo->save = save;
+
+	return 0;
+}
+
+int
+hed_repo_save_commit(struct hed_repo * repo)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(repo->save);
+
+	struct hed_repo_save *save = repo->save;
+	int ret;
+
+	if (repo->log.lost) {
+		/* Lost while growing the map: only aborting is left. */
+		repo_txn_abort(repo);
+		repo->save = save->prev;
+		return MDB_BAD_TXN;
+	}
+
+	/* Changes, replay log records and pending notes merge as is. */
+	ret = mdb_txn_commit(repo->txn);
+	repo->txn = save->parent;
+	repo->save = save->prev;
+	if (ret)
+		/* LMDB leaves the parent in error state. */
+		repo->log.lost = true;
+
+	return ret;
+}
+
+void
+hed_repo_save_abort(struct hed_repo * repo)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(repo->save);
+
+	struct hed_repo_save *save = repo->save;
+	size_t t;
+
+	if (repo->log.lost) {
+		/* The enclosing transaction may only be aborted as a whole. */
+		repo_txn_abort(repo);
+		repo->save = save->prev;
+		return;
+	}
+
+	mdb_txn_abort(repo->txn);
+	repo->txn = save->parent;
+	repo->save = save->prev;
+
+	repo->log.used = save->log_mark;
+	repo->feed.used = save->feed_mark;
+	repo->feed.lost = save->feed_lost;
+
+	/*
+	 * High-water marks raised within the savepoint are back to their former
+	 * values: drop cached blocks which may stem from these.
+	 */
+	if (repo->seq_pending != save->seq_pending) {
+		for (t = 0; t < repo->nb; t++) {
+			if (repo->seq[t].pending) {
+				repo->seq[t].next = 1;
+				repo->seq[t].last = 0;
+			}
+		}
+	}
+
+	/*
+	 * Cached entries invalidated within the savepoint stay so till the
+	 * enclosing transaction ends, which is harmless.
+	 */
+}
+
+#if defined(CONFIG_HED_REPO_3PC)
+int
+hed_repo_rollback(struct hed_repo * repo)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(!repo->txn);
+
+	int ret;
+	MDB_cursor *cursor;
+	MDB_val undo;
+	MDB_val content;
+	MDB_val idx;
+	uint16_t id;
+
+	/*
+	 * The journal holds pre-images of the transaction preceding an aborted
+	 * one or an internal commit: these are not the last committed changes.
+	 */
+	if (!repo->undo)
+		return 0;
+
+	ret = repo_begin(repo, 0);
+	if (ret)
+		return ret;
+
+	/*
+	 * Restoring goes through raw LMDB calls which the replay log does not
+	 * record: the map may not grow while rolling back.
+	 */
+	repo_log_reset(repo, false);
+
+	ret = mdb_cursor_open(repo->txn, repo->dbi[REPO_UNDO_TBL(repo)],
+	                      &cursor);
+	if (ret)
+		goto abort;
+
+	/* Restore pre-images of keys modified by the last transaction. */
+	ret = mdb_cursor_get(cursor, &undo, &content, MDB_FIRST);
+	while (!ret) {
+		hed_assert_intern(undo.mv_size > sizeof(id));
+
+		memcpy(&id, undo.mv_data, sizeof(id));
+		hed_assert_intern(id < REPO_UNDO_TBL(repo));
+
+		idx.mv_data = &((uint8_t *)undo.mv_data)[sizeof(id)];
+		idx.mv_size = undo.mv_size - sizeof(id);
+
+		if (content.mv_size)
+			ret = mdb_put(repo->txn, repo->dbi[id],
+			              &idx, &content, 0);
+		else
+			ret = mdb_del(repo->txn, repo->dbi[id], &idx, NULL);
+		if (ret && (ret != MDB_NOTFOUND))
+			break;
+
+		if (!ret && (id < repo->nb))
+			repo_note(repo, id,
+			          content.mv_size ? HED_REPO_FEED_PUT :
+			                            HED_REPO_FEED_DEL,
+			          &idx);
+
+		ret = mdb_cursor_get(cursor, &undo, &content, MDB_NEXT);
+	}
+
+	mdb_cursor_close(cursor);
+	if (ret != MDB_NOTFOUND)
+		goto abort;
+
+	ret = mdb_drop(repo->txn, repo->dbi[REPO_UNDO_TBL(repo)], 0);
+	if (ret)
+		goto abort;
+
+	ret = hed_repo_commit(repo);
+	repo_seq_reset(repo);
+	return ret;
+abort:
+	hed_repo_abort(repo);
+	return ret;
+}
+#endif
+
+int
+hed_repo_tbl_index(const struct hed_repo * repo,
+                   const char * table)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(table);
+
+	return repo_lookup_table(repo, table);
+}
+
+static int __hed_nonull(1, 3, 5, 6)
+repo_get(MDB_txn * txn,
+         MDB_dbi dbi,
+         const uint8_t * key,
+         size_t klen,
+         uint8_t * * const value,
+         size_t * vlen)
+{
+	hed_assert_intern(txn);
+	hed_assert_intern(key);
+	hed_assert_intern(klen > 0);
+	hed_assert_intern(value);
+	hed_assert_intern(vlen);
+
+	int ret;
+	MDB_val content;
+STROLL_IGNORE_WARN("-Wcast-qual")
+	MDB_val idx = {
+		.mv_data = (uint8_t *)key,
+		.mv_size = klen
+	};
+STROLL_RESTORE_WARN
+
+	ret = mdb_get(txn, dbi, &idx, &content);
+	if (ret)
+		return ret;
+
+	*value = content.mv_data;
+	*vlen = content.mv_size;
+	return 0;
+}
+
+/* Number of items get_many operations may sort without allocation. */
+#define REPO_MANY_STACK_NR 32U
+
+struct repo_many_ctx {
+	MDB_txn *txn;
+	MDB_dbi  dbi;
+};
+
+static int __hed_nonull(1, 2, 3)
+repo_many_cmp(const void * first, const void * second, void * data)
+{
+	hed_assert_intern(first);
+	hed_assert_intern(second);
+	hed_assert_intern(data);
+
+	const struct hed_repo_item *a = *(struct hed_repo_item * const *)first;
+	const struct hed_repo_item *b = *(struct hed_repo_item * const *)second;
+	const struct repo_many_ctx *ctx = data;
+STROLL_IGNORE_WARN("-Wcast-qual")
+	MDB_val ka = {
+		.mv_data = (uint8_t *)a->key,
+		.mv_size = a->klen
+	};
+	MDB_val kb = {
+		.mv_data = (uint8_t *)b->key,
+		.mv_size = b->klen
+	};
+STROLL_RESTORE_WARN
+
+	return mdb_cmp(ctx->txn, ctx->dbi, &ka, &kb);
+}
+
+/*
+ * Look items up in key order through a single cursor: LMDB then only
+ * searches the current leaf page as long as keys stay within its range
+ * instead of descending the tree from its root for every key.
+ */
+static int __hed_nonull(1, 3)
+repo_get_many(MDB_txn * txn,
+              MDB_dbi dbi,
+              struct hed_repo_item * items,
+              size_t nr)
+{
+	hed_assert_intern(txn);
+	hed_assert_intern(items);
+
+	struct hed_repo_item *stack[REPO_MANY_STACK_NR];
+	struct hed_repo_item **order = stack;
+	struct repo_many_ctx ctx = {
+		.txn = txn,
+		.dbi = dbi
+	};
+	MDB_cursor *cursor;
+	MDB_val idx;
+	MDB_val content;
+	size_t i;
+	int ret;
+
+	if (!nr)
+		return 0;
+
+	if (nr > REPO_MANY_STACK_NR) {
+		order = malloc(nr * sizeof(order[0]));
+		if (!order)
+			return -ENOMEM;
+	}
+
+	for (i = 0; i < nr; i++) {
+		hed_assert_api(items[i].key);
+		hed_assert_api(items[i].klen > 0);
+
+		order[i] = &items[i];
+	}
+
+	qsort_r(order, nr, sizeof(order[0]), repo_many_cmp, &ctx);
+
+	ret = mdb_cursor_open(txn, dbi, &cursor);
+	if (ret)
+		goto free;
+
+	for (i = 0; i < nr; i++) {
+		struct hed_repo_item *item = order[i];
+
+STROLL_IGNORE_WARN("-Wcast-qual")
+		idx.mv_data = (uint8_t *)item->key;
+STROLL_RESTORE_WARN
+		idx.mv_size = item->klen;
+
+		item->status = mdb_cursor_get(cursor, &idx, &content, MDB_SET);
+		if (!item->status) {
+			item->value = content.mv_data;
+			item->vlen = content.mv_size;
+		}
+		else {
+			item->value = NULL;
+			item->vlen = 0;
+			if (!ret && (item->status != MDB_NOTFOUND))
+				ret = item->status;
+		}
+	}
+
+	mdb_cursor_close(cursor);
+
+free:
+	if (order != stack)
+		free(order);
+
+	return ret;
+}
+
+int
+hed_repo_tbl_get(struct hed_repo * repo,
+                 unsigned int tbl,
+                 const uint8_t * key,
+                 size_t klen,
+                 uint8_t * * const value,
+                 size_t * vlen)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(repo->txn || repo->log.lost);
+	hed_assert_api(tbl <= HED_REPO_META_TBL(repo));
+	hed_assert_api(key);
+	hed_assert_api(klen > 0);
+	hed_assert_api(value);
+	hed_assert_api(vlen);
+
+	if (repo->log.lost)
+		return MDB_BAD_TXN;
+
+	repo_count_get(repo, 1);
+
+	return repo_get(repo->txn, repo->dbi[tbl], key, klen, value, vlen);
+}
+
+int
+hed_repo_get(struct hed_repo * repo,
+             const char * table,
+             const uint8_t * key,
+             size_t klen,
+             uint8_t * * const value,
+             size_t * vlen)
+{
+	hed_assert_api(repo);
+	hed_assert_api(table);
+
+	int tbl;
+
+	tbl = repo_lookup_table(repo, table);
+	if (tbl < 0)
+		return MDB_NOTFOUND;
+
+	return hed_repo_tbl_get(repo, (unsigned int)tbl, key, klen, value, vlen);
+}
+
+int
+hed_repo_tbl_get_many(struct hed_repo * repo,
+                      unsigned int tbl,
+                      struct hed_repo_item * items,
+                      size_t nr)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(repo->txn || repo->log.lost);
+	hed_assert_api(tbl <= HED_REPO_META_TBL(repo));
+	hed_assert_api(items);
+
+	if (repo->log.lost)
+		return MDB_BAD_TXN;
+
+	repo_count_get(repo, nr);
+
+	return repo_get_many(repo->txn, repo->dbi[tbl], items, nr);
+}
+
+int
+hed_repo_get_many(struct hed_repo * repo,
+                  const char * table,
+                  struct hed_repo_item * items,
+                  size_t nr)
+{
+	hed_assert_api(repo);
+	hed_assert_api(table);
+
+	int tbl;
+
+	tbl = repo_lookup_table(repo, table);
+	if (tbl < 0)
+		return MDB_NOTFOUND;
+
+	return hed_repo_tbl_get_many(repo, (unsigned int)tbl, items, nr);
+}
+
+int
+hed_repo_cache_enable(struct hed_repo * repo,
+                      unsigned int tbl,
+                      size_t obj_size,
+                      hed_repo_decode_fn * decode,
+                      size_t budget)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(!repo->txn);
+	hed_assert_api(tbl < HED_REPO_META_TBL(repo));
+	hed_assert_api(!hed_repo_tbl_dup(repo, tbl));
+	hed_assert_api(!repo->cache || !repo->cache[tbl]);
+	hed_assert_api(obj_size > 0);
+	hed_assert_api(decode);
+	hed_assert_api(budget > 0);
+
+	struct hed_repo_cache *cache;
+
+	if (!repo->cache) {
+		repo->cache = calloc(repo->nb, sizeof(repo->cache[0]));
+		if (!repo->cache)
+			return -ENOMEM;
+	}
+
+	cache = malloc(sizeof(*cache));
+	if (!cache)
+		return -ENOMEM;
+
+	cache->bucket = calloc(REPO_CACHE_BUCKET_NR, sizeof(cache->bucket[0]));
+	if (!cache->bucket) {
+		free(cache);
+		return -ENOMEM;
+	}
+
+	cache->bucket_nr = REPO_CACHE_BUCKET_NR;
+	cache->hand = 0;
+	cache->obj_size = obj_size;
+	cache->decode = decode;
+	cache->budget = budget;
+	cache->pend = NULL;
+	cache->bypass = false;
+	memset(&cache->stats, 0, sizeof(cache->stats));
+
+	repo->cache[tbl] = cache;
+
+	return 0;
+}
+
+void
+hed_repo_cache_disable(struct hed_repo * repo, unsigned int tbl)
+{
+	hed_assert_api(repo);
+	hed_assert_api(!repo->txn);
+	hed_assert_api(tbl < HED_REPO_META_TBL(repo));
+
+	struct hed_repo_cache *cache;
+
+	if (!repo->cache || !repo->cache[tbl])
+		return;
+
+	cache = repo->cache[tbl];
+	repo_cache_flush(cache);
+	free(cache->bucket);
+	free(cache);
+	repo->cache[tbl] = NULL;
+}
+
+int
+hed_repo_cache_get(struct hed_repo * repo,
+                   unsigned int tbl,
+                   const uint8_t * key,
+                   size_t klen,
+                   void * object)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(repo->txn || repo->log.lost);
+	hed_assert_api(tbl < HED_REPO_META_TBL(repo));
+	hed_assert_api(repo->cache && repo->cache[tbl]);
+	hed_assert_api(key);
+	hed_assert_api(klen > 0);
+	hed_assert_api(klen <= HED_REPO_KEY_MAX);
+	hed_assert_api(object);
+
+	struct hed_repo_cache *cache = repo->cache[tbl];
+	uint32_t hash = repo_cache_hash(key, klen);
+	struct repo_cache_ent *ent;
+	uint8_t *data;
+	size_t size;
+	int ret;
+STROLL_IGNORE_WARN("-Wcast-qual")
+	MDB_val idx = {
+		.mv_data = (uint8_t *)key,
+		.mv_size = klen
+	};
+STROLL_RESTORE_WARN
+
+	if (repo->log.lost)
+		return MDB_BAD_TXN;
+
+	repo_count_get(repo, 1);
+
+	ent = repo_cache_find(cache, hash, &idx);
+	if (ent && (ent->state == REPO_CACHE_VALID)) {
+		ent->ref = true;
+		cache->stats.hit++;
+		memcpy(object, &ent->data[klen], cache->obj_size);
+		return 0;
+	}
+
+	cache->stats.miss++;
+
+	ret = repo_get(repo->txn, repo->dbi[tbl], key, klen, &data, &size);
+	if (ret)
+		return ret;
+
+	ret = cache->decode(data, size, object);
+	if (ret)
+		return ret;
+
+	/* Keys modified by the write transaction bypass the cache. */
+	if (!ent && !cache->bypass)
+		ent = repo_cache_insert(cache, hash, &idx, object);
+
+	return 0;
+}
+
+void
+hed_repo_cache_stats(const struct hed_repo * repo,
+                     unsigned int tbl,
+                     struct hed_repo_cache_stats * stats)
+{
+	hed_assert_api(repo);
+	hed_assert_api(tbl < HED_REPO_META_TBL(repo));
+	hed_assert_api(repo->cache && repo->cache[tbl]);
+	hed_assert_api(stats);
+
+	*stats = repo->cache[tbl]->stats;
+}
+
+int
+hed_repo_tbl_update(struct hed_repo * repo,
+                    unsigned int tbl,
+                    const uint8_t * key,
+                    size_t klen,
+                    const uint8_t * value,
+                    size_t vlen)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(repo->txn || repo->log.lost);
+	hed_assert_api(tbl <= HED_REPO_META_TBL(repo));
+	hed_assert_api(!hed_repo_tbl_secondary(repo, tbl));
+	hed_assert_api(key);
+	hed_assert_api(klen > 0);
+	hed_assert_api(value);
+	hed_assert_api(vlen > 0);
+
+	int ret;
+STROLL_IGNORE_WARN("-Wcast-qual")
+	MDB_val idx = {
+		.mv_data = (uint8_t *)key,
+		.mv_size = klen
+	};
+	MDB_val content = {
+		.mv_data = (uint8_t *)value,
+		.mv_size = vlen
+	};
+STROLL_RESTORE_WARN
+
+	if (repo->log.lost)
+		return MDB_BAD_TXN;
+
+#if defined(CONFIG_HED_REPO_3PC)
+	ret = repo_undo_record(repo, tbl, &idx);
+	if (ret)
+		return ret;
+#endif
+
+	ret = repo_index_sync(repo, tbl, &idx, &content, false);
+	if (ret)
+		return ret;
+
+	return repo_put(repo, tbl, &idx, &content, 0);
+}
+
+int
+hed_repo_update(struct hed_repo * repo,
+                const char * table,
+                const uint8_t * key,
+                size_t klen,
+                const uint8_t * value,
+                size_t vlen)
+{
+	hed_assert_api(repo);
+	hed_assert_api(table);
+
+	int tbl;
+
+	tbl = repo_lookup_table(repo, table);
+	if (tbl < 0)
+		return MDB_NOTFOUND;
+
+	return hed_repo_tbl_update(repo, (unsigned int)tbl,
+	                           key, klen, value, vlen);
+}
+
+int
+hed_repo_tbl_reserve(struct hed_repo_resv * resv,
+                     struct hed_repo * repo,
+                     unsigned int tbl,
+                     const uint8_t * key,
+                     size_t klen,
+                     size_t vlen)
+{
+	hed_assert_api(resv);
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(repo->txn || repo->log.lost);
+	hed_assert_api(tbl <= HED_REPO_META_TBL(repo));
+	/* LMDB does not reserve duplicate values. */
+	hed_assert_api(!hed_repo_tbl_dup(repo, tbl));
+	hed_assert_api(!hed_repo_tbl_secondary(repo, tbl));
+	hed_assert_api(key);
+	hed_assert_api(klen > 0);
+	hed_assert_api(vlen > 0);
+
+	int ret;
+	MDB_val content = {
+		.mv_data = NULL,
+		.mv_size = vlen
+	};
+
+	if (repo->log.lost)
+		return MDB_BAD_TXN;
+
+STROLL_IGNORE_WARN("-Wcast-qual")
+	resv->idx.mv_data = (uint8_t *)key;
+STROLL_RESTORE_WARN
+	resv->idx.mv_size = klen;
+
+#if defined(CONFIG_HED_REPO_3PC)
+	ret = repo_undo_record(repo, tbl, &resv->idx);
+	if (ret)
+		return ret;
+#endif
+
+	/* Index keys of the new value are added once it is sealed. */
+	ret = repo_index_sync(repo, tbl, &resv->idx, NULL, false);
+	if (ret)
+		return ret;
+
+	ret = repo_put(repo, tbl, &resv->idx, &content, MDB_RESERVE);
+	if (ret)
+		return ret;
+
+	resv->repo = repo;
+	resv->tbl = tbl;
+	resv->data = content.mv_data;
+	resv->size = vlen;
+	resv->loff = repo->log.on ? repo->log.used - vlen : 0;
+	dpack_encoder_init_buffer(&resv->encoder, (char *)resv->data, vlen);
+
+	return 0;
+}
+
+int
+hed_repo_reserve(struct hed_repo_resv * resv,
+                 struct hed_repo * repo,
+                 const char * table,
+                 const uint8_t * key,
+                 size_t klen,
+                 size_t vlen)
+{
+	hed_assert_api(repo);
+	hed_assert_api(table);
+
+	int tbl;
+
+	tbl = repo_lookup_table(repo, table);
+	if (tbl < 0)
+		return MDB_NOTFOUND;
+
+	return hed_repo_tbl_reserve(resv, repo, (unsigned int)tbl,
+	                            key, klen, vlen);
+}
+
+int
+hed_repo_reserve_end(struct hed_repo_resv * resv)
+{
+	hed_assert_api(resv);
+	hed_assert_api(resv->repo);
+	hed_assert_api(resv->repo->txn || resv->repo->log.lost);
+	hed_assert_api(resv->data);
+
+	struct hed_repo *repo = resv->repo;
+	size_t used = dpack_encoder_space_used(&resv->encoder);
+	MDB_val content;
+	int ret;
+
+	if (repo->log.lost)
+		return MDB_BAD_TXN;
+
+	dpack_encoder_fini(&resv->encoder, DPACK_DONE);
+
+	if (repo->log.on)
+		memcpy(&repo->log.data[resv->loff], resv->data, used);
+
+	if (used == resv->size) {
+		content.mv_data = resv->data;
+		content.mv_size = used;
+
+		return repo_index_sync(repo, resv->tbl, &resv->idx, &content,
+		                       true);
+	}
+
+	if (!used) {
+		/*
+		 * Nothing was encoded: remove the entry instead of leaving the
+		 * reserved garbage behind. Index keys of the former value were
+		 * dropped at reservation time already.
+		 */
+		if (hed_repo_tbl_ttl(repo, resv->tbl)) {
+			ret = repo_ttl_clear(repo, resv->tbl, &resv->idx);
+			if (ret)
+				return ret;
+		}
+
+		ret = repo_del(repo, resv->tbl, &resv->idx);
+
+		return ret ? ret : -ENODATA;
+	}
+
+	/*
+	 * The encoded value is shorter than reserved: store it again with its
+	 * actual size. It has to move out of the page first since LMDB
+	 * relocates the record while resizing it.
+	 */
+
+	content.mv_data = malloc(used);
+	if (!content.mv_data)
+		return -ENOMEM;
+
+	memcpy(content.mv_data, resv->data, used);
+	content.mv_size = used;
+	ret = repo_put(repo, resv->tbl, &resv->idx, &content, 0);
+	if (!ret)
+		ret = repo_index_sync(repo, resv->tbl, &resv->idx, &content,
+		                      true);
+
+	free(content.mv_data);
+
+	return ret;
+}
+
+int
+hed_repo_tbl_del(struct hed_repo * repo,
+                 unsigned int tbl,
+                 const uint8_t * key,
+                 size_t klen)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(repo->txn || repo->log.lost);
+	hed_assert_api(tbl <= HED_REPO_META_TBL(repo));
+	hed_assert_api(!hed_repo_tbl_secondary(repo, tbl));
+	hed_assert_api(key);
+	hed_assert_api(klen > 0);
+
+	int ret;
+STROLL_IGNORE_WARN("-Wcast-qual")
+	MDB_val idx = {
+		.mv_data = (uint8_t *)key,
+		.mv_size = klen
+	};
+STROLL_RESTORE_WARN
+
+	if (repo->log.lost)
+		return MDB_BAD_TXN;
+
+#if defined(CONFIG_HED_REPO_3PC)
+	ret = repo_undo_record(repo, tbl, &idx);
+	if (ret)
+		return ret;
+#endif
+
+	ret = repo_index_sync(repo, tbl, &idx, NULL, false);
+	if (ret)
+		return ret;
+
+	if (hed_repo_tbl_ttl(repo, tbl)) {
+		ret = repo_ttl_clear(repo, tbl, &idx);
+		if (ret)
+			return ret;
+	}
+
+	return repo_del(repo, tbl, &idx);
+}
+
+int
+hed_repo_tbl_get_dup(struct hed_repo * repo,
+                     unsigned int tbl,
+                     const uint8_t * key,
+                     size_t klen,
+                     const uint8_t * value,
+                     size_t vlen)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(repo->txn || repo->log.lost);
+	hed_assert_api(hed_repo_tbl_dup(repo, tbl));
+	hed_assert_api(key);
+	hed_assert_api(klen > 0);
+	hed_assert_api(value);
+	hed_assert_api(vlen > 0);
+
+	MDB_cursor *cursor;
+	int ret;
+STROLL_IGNORE_WARN("-Wcast-qual")
+	MDB_val idx = {
+		.mv_data = (uint8_t *)key,
+		.mv_size = klen
+	};
+	MDB_val content = {
+		.mv_data = (uint8_t *)value,
+		.mv_size = vlen
+	};
+STROLL_RESTORE_WARN
+
+	if (repo->log.lost)
+		return MDB_BAD_TXN;
+
+	repo_count_get(repo, 1);
+
+	ret = mdb_cursor_open(repo->txn, repo->dbi[tbl], &cursor);
+	if (ret)
+		return ret;
+
+	ret = mdb_cursor_get(cursor, &idx, &content, MDB_GET_BOTH);
+
+	mdb_cursor_close(cursor);
+
+	return ret;
+}
+
+int
+hed_repo_tbl_del_dup(struct hed_repo * repo,
+                     unsigned int tbl,
+                     const uint8_t * key,
+                     size_t klen,
+                     const uint8_t * value,
+                     size_t vlen)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(repo->txn || repo->log.lost);
+	hed_assert_api(hed_repo_tbl_dup(repo, tbl));
+	hed_assert_api(!hed_repo_tbl_secondary(repo, tbl));
+	hed_assert_api(key);
+	hed_assert_api(klen > 0);
+	hed_assert_api(value);
+	hed_assert_api(vlen > 0);
+
+STROLL_IGNORE_WARN("-Wcast-qual")
+	MDB_val idx = {
+		.mv_data = (uint8_t *)key,
+		.mv_size = klen
+	};
+	MDB_val content = {
+		.mv_data = (uint8_t *)value,
+		.mv_size = vlen
+	};
+STROLL_RESTORE_WARN
+
+	if (repo->log.lost)
+		return MDB_BAD_TXN;
+
+	return repo_write(repo, REPO_LOG_DEL, tbl, &idx, &content, 0);
+}
+
+ssize_t
+hed_repo_tbl_count_dup(struct hed_repo * repo,
+                       unsigned int tbl,
+                       const uint8_t * key,
+                       size_t klen)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(repo->txn || repo->log.lost);
+	hed_assert_api(hed_repo_tbl_dup(repo, tbl));
+	hed_assert_api(key);
+	hed_assert_api(klen > 0);
+
+	MDB_cursor *cursor;
+	MDB_val content;
+	size_t nr;
+	int ret;
+STROLL_IGNORE_WARN("-Wcast-qual")
+	MDB_val idx = {
+		.mv_data = (uint8_t *)key,
+		.mv_size = klen
+	};
+STROLL_RESTORE_WARN
+
+	if (repo->log.lost)
+		return MDB_BAD_TXN;
+
+	ret = mdb_cursor_open(repo->txn, repo->dbi[tbl], &cursor);
+	if (ret)
+		return repo_count_error(ret);
+
+	ret = mdb_cursor_get(cursor, &idx, &content, MDB_SET);
+	if (!ret)
+		ret = mdb_cursor_count(cursor, &nr);
+
+	mdb_cursor_close(cursor);
+
+	if (ret == MDB_NOTFOUND)
+		return 0;
+	if (ret)
+		return repo_count_error(ret);
+
+	return (ssize_t)nr;
+}
+
+int
+hed_repo_del(struct hed_repo * repo,
+                const char * table,
+                const uint8_t * key,
+                size_t klen)
+
+{
+	hed_assert_api(repo);
+	hed_assert_api(table);
+
+	int tbl;
+
+	tbl = repo_lookup_table(repo, table);
+	if (tbl < 0)
+		return MDB_NOTFOUND;
+
+	return hed_repo_tbl_del(repo, (unsigned int)tbl, key, klen);
+}
+
+int
+hed_repo_tbl_set_deadline(struct hed_repo * repo,
+                          unsigned int tbl,
+                          const uint8_t * key,
+                          size_t klen,
+                          const struct timespec * deadline)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(repo->txn || repo->log.lost);
+	hed_assert_api(hed_repo_tbl_ttl(repo, tbl));
+	hed_assert_api(key);
+	hed_assert_api(klen > 0);
+
+	uint8_t buf[REPO_TTL_HDR_SIZE + HED_REPO_TTL_KEY_MAX];
+	uint8_t mark = REPO_TTL_DEADLINE;
+	uint64_t msec;
+	uint64_t be;
+	MDB_val ttl;
+	MDB_val content;
+	int ret;
+STROLL_IGNORE_WARN("-Wcast-qual")
+	MDB_val idx = {
+		.mv_data = (uint8_t *)key,
+		.mv_size = klen
+	};
+STROLL_RESTORE_WARN
+
+	if (repo->log.lost)
+		return MDB_BAD_TXN;
+
+	if (klen > HED_REPO_TTL_KEY_MAX)
+		return MDB_BAD_VALSIZE;
+
+	ret = mdb_get(repo->txn, repo->dbi[tbl], &idx, &content);
+	if (ret)
+		return ret;
+
+	ret = repo_ttl_clear(repo, tbl, &idx);
+	if (ret || !deadline)
+		return ret;
+
+	msec = repo_ttl_msec(deadline);
+	be = htobe64(msec);
+
+	content.mv_data = &be;
+	content.mv_size = sizeof(be);
+	repo_ttl_key(&ttl, buf, REPO_TTL_ENTRY, 0, repo->ttl_id[tbl], &idx);
+	ret = repo_ttl_write(repo, REPO_LOG_PUT, &ttl, &content);
+	if (ret)
+		return ret;
+
+	content.mv_data = &mark;
+	content.mv_size = sizeof(mark);
+	repo_ttl_key(&ttl, buf, REPO_TTL_DEADLINE, msec, repo->ttl_id[tbl],
+	             &idx);
+
+	return repo_ttl_write(repo, REPO_LOG_PUT, &ttl, &content);
+}
+
+int
+hed_repo_tbl_get_deadline(struct hed_repo * repo,
+                          unsigned int tbl,
+                          const uint8_t * key,
+                          size_t klen,
+                          struct timespec * deadline)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(repo->txn || repo->log.lost);
+	hed_assert_api(hed_repo_tbl_ttl(repo, tbl));
+	hed_assert_api(key);
+	hed_assert_api(klen > 0);
+	hed_assert_api(deadline);
+
+	uint8_t buf[REPO_TTL_HDR_SIZE + HED_REPO_TTL_KEY_MAX];
+	uint64_t msec;
+	MDB_val ttl;
+	MDB_val content;
+	int ret;
+STROLL_IGNORE_WARN("-Wcast-qual")
+	MDB_val idx = {
+		.mv_data = (uint8_t *)key,
+		.mv_size = klen
+	};
+STROLL_RESTORE_WARN
+
+	if (repo->log.lost)
+		return MDB_BAD_TXN;
+
+	if (klen > HED_REPO_TTL_KEY_MAX)
+		return MDB_NOTFOUND;
+
+	repo_count_get(repo, 1);
+
+	repo_ttl_key(&ttl, buf, REPO_TTL_ENTRY, 0, repo->ttl_id[tbl], &idx);
+	ret = mdb_get(repo->txn, repo->dbi[REPO_TTL_TBL(repo)], &ttl, &content);
+	if (ret)
+		return ret;
+
+	hed_assert_intern(content.mv_size == sizeof(msec));
+	memcpy(&msec, content.mv_data, sizeof(msec));
+	msec = be64toh(msec);
+
+	deadline->tv_sec = (time_t)(msec / 1000U);
+	deadline->tv_nsec = (long)(msec % 1000U) * 1000000L;
+
+	return 0;
+}
+
+ssize_t
+hed_repo_expire(struct hed_repo * repo,
+                const struct timespec * now,
+                unsigned int nr)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(repo->txn || repo->log.lost);
+	hed_assert_api(now);
+	hed_assert_api(nr > 0);
+
+	uint8_t buf[HED_REPO_KEY_MAX];
+	uint8_t ent[HED_REPO_KEY_MAX];
+	uint8_t tag = REPO_TTL_DEADLINE;
+	uint64_t limit = repo_ttl_msec(now);
+	uint64_t deadline;
+	uint16_t id;
+	MDB_cursor *cursor;
+	MDB_val ttl;
+	MDB_val content;
+	unsigned int cnt;
+	int tbl;
+	int ret = 0;
+
+	if (repo->log.lost)
+		return MDB_BAD_TXN;
+
+	if (!repo->ttl_nr)
+		return 0;
+
+	for (cnt = 0; cnt < nr; cnt++) {
+		/*
+		 * Deletions would invalidate a cursor kept across iterations,
+		 * and prevent map growth: seek the earliest deadline each time.
+		 */
+		ret = mdb_cursor_open(repo->txn,
+		                      repo->dbi[REPO_TTL_TBL(repo)],
+		                      &cursor);
+		if (ret)
+			break;
+
+		ttl.mv_data = &tag;
+		ttl.mv_size = sizeof(tag);
+		ret = mdb_cursor_get(cursor, &ttl, &content, MDB_SET_RANGE);
+		if (!ret) {
+			hed_assert_intern(ttl.mv_size <= sizeof(buf));
+			memcpy(buf, ttl.mv_data, ttl.mv_size);
+			ttl.mv_data = buf;
+		}
+
+		mdb_cursor_close(cursor);
+		if (ret)
+			break;
+
+		if ((ttl.mv_size <= REPO_TTL_HDR_SIZE) || (buf[0] != tag)) {
+			ret = MDB_NOTFOUND;
+			break;
+		}
+
+		memcpy(&deadline, &buf[sizeof(tag)], sizeof(deadline));
+		if (be64toh(deadline) > limit) {
+			ret = MDB_NOTFOUND;
+			break;
+		}
+
+		memcpy(&id, &buf[sizeof(tag) + sizeof(deadline)], sizeof(id));
+		tbl = repo_ttl_table(repo, be16toh(id));
+		if (tbl >= 0) {
+			/* Entry deletion drops its deadline along. */
+			ret = hed_repo_tbl_del(repo, (unsigned int)tbl,
+			                       &buf[REPO_TTL_HDR_SIZE],
+			                       ttl.mv_size - REPO_TTL_HDR_SIZE);
+		}
+		else {
+			/*
+			 * The table is no longer subject to expiry: forget the
+			 * deadline, which shares its identifier and key with
+			 * the entry record.
+			 */
+			MDB_val rec = {
+				.mv_data = ent,
+				.mv_size = ttl.mv_size - sizeof(deadline)
+			};
+
+			ent[0] = REPO_TTL_ENTRY;
+			memcpy(&ent[sizeof(tag)],
+			       &buf[sizeof(tag) + sizeof(deadline)],
+			       rec.mv_size - sizeof(tag));
+			ret = repo_ttl_write(repo, REPO_LOG_DEL, &rec, NULL);
+		}
+		if (ret && (ret != MDB_NOTFOUND))
+			break;
+
+		/* Dangling deadlines must not stall expiry. */
+		ret = repo_ttl_write(repo, REPO_LOG_DEL, &ttl, NULL);
+		if (ret && (ret != MDB_NOTFOUND))
+			break;
+		ret = 0;
+	}
+
+	if (ret && (ret != MDB_NOTFOUND))
+		return repo_count_error(ret);
+
+	return (ssize_t)cnt;
+}
+
+ssize_t
+hed_repo_tbl_count(struct hed_repo * repo,
+                   unsigned int tbl)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(repo->txn || repo->log.lost);
+	hed_assert_api(tbl <= HED_REPO_META_TBL(repo));
+
+	MDB_stat stat;
+	int ret;
+
+	if (repo->log.lost)
+		return MDB_BAD_TXN;
+
+	ret = mdb_stat(repo->txn, repo->dbi[tbl], &stat);
+	if (ret)
+		return repo_count_error(ret);
+
+	return (ssize_t)stat.ms_entries;
+}
+
+ssize_t
+hed_repo_count(struct hed_repo * repo,
+               const char * table)
+{
+	hed_assert_api(repo);
+	hed_assert_api(table);
+
+	int tbl;
+
+	tbl = repo_lookup_table(repo, table);
+	if (tbl < 0)
+		return MDB_NOTFOUND;
+
+	return hed_repo_tbl_count(repo, (unsigned int)tbl);
+}
+
+uint32_t
+hed_repo_tbl_next_seq(struct hed_repo * repo,
+                      unsigned int tbl)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(tbl < HED_REPO_META_TBL(repo));
+
+	struct hed_repo_seq *seq = &repo->seq[tbl];
+
+	/* Blocks may not be reserved from a lost transaction. */
+	if (repo->log.lost)
+		return 0;
+
+	/* Handing out UINT32_MAX wrapped next: sequence is exhausted. */
+	if (!seq->next)
+		return 0;
+
+	if (seq->next > seq->last) {
+		if (repo_seq_reserve(repo, tbl))
+			return 0;
+	}
+
+	return seq->next++;
+}
+
+uint32_t
+hed_repo_next_seq(struct hed_repo * repo,
+                  const char * table)
+{
+	hed_assert_api(repo);
+	hed_assert_api(table);
+
+	int tbl;
+
+	tbl = repo_lookup_table(repo, table);
+	if ((tbl < 0) || ((unsigned int)tbl == HED_REPO_META_TBL(repo)))
+		return 0;
+
+	return hed_repo_tbl_next_seq(repo, (unsigned int)tbl);
+}
+
+/* Internal iterator flag: stop as soon as keys no longer match `bound'. */
+#define REPO_ITER_PREFIX (1U << 16)
+/* Internal iterator flag: walk values of the `seek' key. */
+#define REPO_ITER_DUP    (1U << 17)
+/* Internal iterator flag: values are keys of the `primary' table. */
+#define REPO_ITER_INDEX  (1U << 18)
+
+static bool __hed_nonull(1, 2)
+repo_iter_in_range(const struct hed_repo_iter * iter, MDB_val * idx)
+{
+	hed_assert_intern(iter);
+	hed_assert_intern(iter->cursor);
+	hed_assert_intern(idx);
+
+	int cmp;
+STROLL_IGNORE_WARN("-Wcast-qual")
+	MDB_val bound = {
+		.mv_data = (uint8_t *)iter->bound,
+		.mv_size = iter->blen
+	};
+STROLL_RESTORE_WARN
+
+	if (!iter->bound)
+		return true;
+
+	if (iter->flags & REPO_ITER_PREFIX)
+		return (idx->mv_size >= iter->blen) &&
+		       !memcmp(idx->mv_data, iter->bound, iter->blen);
+
+	cmp = mdb_cmp(mdb_cursor_txn(iter->cursor),
+	              mdb_cursor_dbi(iter->cursor),
+	              idx,
+	              &bound);
+
+	/* Forward lower bound and reverse upper bound are given by the seek. */
+	return (iter->flags & HED_REPO_ITER_REVERSE) ? (cmp >= 0) : (cmp < 0);
+}
+
+/*
+ * Position cursor onto the first key >= `seek' when iterating forward, or onto
+ * the last key < `seek' when iterating backward. A NULL `seek' stands for the
+ * table's first, respectively last, key.
+ */
+static int __hed_nonull(1)
+repo_iter_seek(struct hed_repo_iter * iter, const MDB_val * seek)
+{
+	hed_assert_intern(iter);
+	hed_assert_intern(iter->cursor);
+
+	int ret;
+	MDB_val idx;
+	/*
+	 * LMDB stores the data of DUPFIXED sub-pages through this pointer:
+	 * never position cursors without one.
+	 */
+	MDB_val content;
+
+	if (iter->flags & REPO_ITER_DUP) {
+		hed_assert_intern(seek);
+
+		idx = *seek;
+		ret = mdb_cursor_get(iter->cursor, &idx, &content, MDB_SET_KEY);
+		if (!ret && (iter->flags & HED_REPO_ITER_REVERSE))
+			ret = mdb_cursor_get(iter->cursor, &idx, &content,
+			                     MDB_LAST_DUP);
+
+		return ret;
+	}
+
+	if (!(iter->flags & HED_REPO_ITER_REVERSE)) {
+		if (!seek)
+			ret = mdb_cursor_get(iter->cursor, &idx, &content,
+			                     MDB_FIRST);
+		else {
+			idx = *seek;
+			ret = mdb_cursor_get(iter->cursor, &idx, &content,
+			                     MDB_SET_RANGE);
+		}
+	}
+	else {
+		ret = MDB_NOTFOUND;
+		if (seek) {
+			idx = *seek;
+			ret = mdb_cursor_get(iter->cursor, &idx, &content,
+			                     MDB_SET_RANGE);
+			if (!ret)
+				ret = mdb_cursor_get(iter->cursor, &idx, &content,
+				                     MDB_PREV);
+			else if (ret != MDB_NOTFOUND)
+				return ret;
+			else
+				ret = mdb_cursor_get(iter->cursor, &idx, &content,
+				                     MDB_LAST);
+		}
+		else
+			ret = mdb_cursor_get(iter->cursor, &idx, &content,
+			                     MDB_LAST);
+	}
+
+	if (ret)
+		return ret;
+
+	return repo_iter_in_range(iter, &idx) ? 0 : MDB_NOTFOUND;
+}
+
+/* Cursors of the write transaction prevent it from being replayed. */
+static void __hed_nonull(1)
+repo_iter_close(struct hed_repo_iter * iter)
+{
+	hed_assert_intern(iter);
+	hed_assert_intern(iter->cursor);
+	hed_assert_intern(iter->repo);
+
+	struct hed_repo *repo = iter->repo;
+
+	if (repo->txn && (mdb_cursor_txn(iter->cursor) == repo->txn)) {
+		hed_assert_intern(repo->log.cursor_nr);
+		repo->log.cursor_nr--;
+	}
+
+	mdb_cursor_close(iter->cursor);
+	iter->cursor = NULL;
+}
+
+static int __hed_nonull(1, 2, 3)
+repo_iter_setup(struct hed_repo_iter * iter,
+                struct hed_repo * repo,
+                MDB_txn * txn,
+                MDB_dbi dbi,
+                const MDB_val * seek,
+                const uint8_t * bound,
+                size_t blen,
+                unsigned int flags,
+                bool renew)
+{
+	hed_assert_intern(iter);
+	hed_assert_intern(repo);
+	hed_assert_intern(txn);
+	hed_assert_intern(!bound || blen);
+
+	int ret;
+
+	if (iter->cursor) {
+		/*
+		 * Cursors of read-only transactions survive their transaction
+		 * and may be rebound to another one without reallocation.
+		 */
+		if (iter->renew && renew &&
+		    (mdb_cursor_dbi(iter->cursor) == dbi)) {
+			ret = mdb_cursor_renew(txn, iter->cursor);
+			if (!ret)
+				goto seek;
+		}
+
+		repo_iter_close(iter);
+	}
+
+	ret = mdb_cursor_open(txn, dbi, &iter->cursor);
+	if (ret) {
+		iter->cursor = NULL;
+		return ret;
+	}
+
+	if (txn == repo->txn)
+		repo->log.cursor_nr++;
+
+seek:
+	iter->repo = repo;
+	if (flags & REPO_ITER_DUP)
+		iter->step = (flags & HED_REPO_ITER_REVERSE) ? MDB_PREV_DUP :
+		                                               MDB_NEXT_DUP;
+	else
+		iter->step = (flags & HED_REPO_ITER_REVERSE) ? MDB_PREV :
+		                                               MDB_NEXT;
+	iter->flags = flags;
+	iter->bound = bound;
+	iter->blen = blen;
+	iter->renew = renew;
+
+	return repo_iter_seek(iter, seek);
+}
+
+static int __hed_nonull(1, 2, 3)
+repo_iter_range(struct hed_repo_iter * iter,
+                struct hed_repo * repo,
+                MDB_txn * txn,
+                MDB_dbi dbi,
+                const uint8_t * lo,
+                size_t llen,
+                const uint8_t * hi,
+                size_t hlen,
+                unsigned int flags,
+                bool renew)
+{
+	hed_assert_intern(iter);
+	hed_assert_intern(repo);
+	hed_assert_intern(txn);
+	hed_assert_intern(!lo || llen);
+	hed_assert_intern(!hi || hlen);
+
+STROLL_IGNORE_WARN("-Wcast-qual")
+	MDB_val lkey = {
+		.mv_data = (uint8_t *)lo,
+		.mv_size = llen
+	};
+	MDB_val hkey = {
+		.mv_data = (uint8_t *)hi,
+		.mv_size = hlen
+	};
+STROLL_RESTORE_WARN
+
+	if (flags & HED_REPO_ITER_REVERSE)
+		return repo_iter_setup(iter, repo, txn, dbi,
+		                       hi ? &hkey : NULL, lo, llen,
+		                       flags, renew);
+
+	return repo_iter_setup(iter, repo, txn, dbi,
+	                       lo ? &lkey : NULL, hi, hlen,
+	                       flags, renew);
+}
+
+static int __hed_nonull(1, 2, 3, 5)
+repo_iter_prefix(struct hed_repo_iter * iter,
+                 struct hed_repo * repo,
+                 MDB_txn * txn,
+                 MDB_dbi dbi,
+                 const uint8_t * prefix,
+                 size_t plen,
+                 unsigned int flags,
+                 bool renew)
+{
+	hed_assert_intern(iter);
+	hed_assert_intern(repo);
+	hed_assert_intern(txn);
+	hed_assert_intern(prefix);
+	hed_assert_intern(plen > 0);
+
+	uint8_t succ[HED_REPO_KEY_MAX];
+	size_t slen = stroll_min(plen, sizeof(succ));
+STROLL_IGNORE_WARN("-Wcast-qual")
+	MDB_val seek = {
+		.mv_data = (uint8_t *)prefix,
+		.mv_size = plen
+	};
+STROLL_RESTORE_WARN
+
+	flags |= REPO_ITER_PREFIX;
+	if (!(flags & HED_REPO_ITER_REVERSE))
+		return repo_iter_setup(iter, repo, txn, dbi,
+		                       &seek, prefix, plen, flags, renew);
+
+	/*
+	 * Start backward iteration from the smallest key greater than all keys
+	 * matching prefix, i.e. prefix with its last non 0xff byte incremented.
+	 */
+	while (slen && (prefix[slen - 1] == 0xff))
+		slen--;
+	if (!slen)
+		return repo_iter_setup(iter, repo, txn, dbi,
+		                       NULL, prefix, plen, flags, renew);
+
+	memcpy(succ, prefix, slen);
+	succ[slen - 1]++;
+	seek.mv_data = succ;
+	seek.mv_size = slen;
+
+	return repo_iter_setup(iter, repo, txn, dbi,
+	                       &seek, prefix, plen, flags, renew);
+}
+
+static struct hed_repo_iter * __hed_nonull(1)
+repo_iter_release(struct hed_repo_iter * iter, int ret)
+{
+	hed_assert_intern(iter);
+
+	if (!ret)
+		return iter;
+
+	hed_repo_iter_fini(iter);
+	free(iter);
+	return NULL;
+}
+
+int
+hed_repo_tbl_iter_range(struct hed_repo_iter * iter,
+                        struct hed_repo * repo,
+                        unsigned int tbl,
+                        const uint8_t * lo,
+                        size_t llen,
+                        const uint8_t * hi,
+                        size_t hlen,
+                        unsigned int flags)
+{
+	hed_assert_api(iter);
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(repo->txn || repo->log.lost);
+	hed_assert_api(tbl <= HED_REPO_META_TBL(repo));
+	hed_assert_api(!lo || llen);
+	hed_assert_api(!hi || hlen);
+	hed_assert_api(!(flags & ~HED_REPO_ITER_REVERSE));
+
+	if (repo->log.lost)
+		return MDB_BAD_TXN;
+
+	return repo_iter_range(iter, repo, repo->txn, repo->dbi[tbl],
+	                       lo, llen, hi, hlen, flags, false);
+}
+
+int
+hed_repo_tbl_iter_prefix(struct hed_repo_iter * iter,
+                         struct hed_repo * repo,
+                         unsigned int tbl,
+                         const uint8_t * prefix,
+                         size_t plen,
+                         unsigned int flags)
+{
+	hed_assert_api(iter);
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(repo->txn || repo->log.lost);
+	hed_assert_api(tbl <= HED_REPO_META_TBL(repo));
+	/* Native integers do not sort bytewise. */
+	hed_assert_api(!hed_repo_tbl_intkey(repo, tbl));
+	hed_assert_api(prefix);
+	hed_assert_api(plen > 0);
+	hed_assert_api(!(flags & ~HED_REPO_ITER_REVERSE));
+
+	if (repo->log.lost)
+		return MDB_BAD_TXN;
+
+	return repo_iter_prefix(iter, repo, repo->txn, repo->dbi[tbl],
+	                        prefix, plen, flags, false);
+}
+
+int
+hed_repo_tbl_iter_dup(struct hed_repo_iter * iter,
+                      struct hed_repo * repo,
+                      unsigned int tbl,
+                      const uint8_t * key,
+                      size_t klen,
+                      unsigned int flags)
+{
+	hed_assert_api(iter);
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(repo->txn || repo->log.lost);
+	hed_assert_api(hed_repo_tbl_dup(repo, tbl));
+	hed_assert_api(key);
+	hed_assert_api(klen > 0);
+	hed_assert_api(!(flags & ~HED_REPO_ITER_REVERSE));
+
+STROLL_IGNORE_WARN("-Wcast-qual")
+	MDB_val seek = {
+		.mv_data = (uint8_t *)key,
+		.mv_size = klen
+	};
+STROLL_RESTORE_WARN
+
+	if (repo->log.lost)
+		return MDB_BAD_TXN;
+
+	if (hed_repo_tbl_secondary(repo, tbl)) {
+		iter->primary = repo->dbi[repo->desc[tbl].primary];
+		flags |= REPO_ITER_INDEX;
+	}
+
+	return repo_iter_setup(iter, repo, repo->txn, repo->dbi[tbl],
+	                       &seek, NULL, 0, flags | REPO_ITER_DUP, false);
+}
+
+int
+hed_repo_step_multiple(struct hed_repo_iter * iter,
+                       uint8_t * * const values,
+                       size_t * size)
+{
+	hed_assert_api(iter);
+	hed_assert_api(iter->cursor);
+	hed_assert_api(iter->flags & REPO_ITER_DUP);
+	hed_assert_api(!(iter->flags & HED_REPO_ITER_REVERSE));
+	hed_assert_api(values);
+	hed_assert_api(size);
+
+	MDB_val idx;
+	MDB_val content;
+	int ret;
+
+	/* The first chunk starts at the key's first value. */
+	ret = mdb_cursor_get(iter->cursor, &idx, &content,
+	                     (iter->step == MDB_NEXT_MULTIPLE) ?
+	                     MDB_NEXT_MULTIPLE : MDB_GET_MULTIPLE);
+	if (ret)
+		return ret;
+
+	iter->step = MDB_NEXT_MULTIPLE;
+	*values = content.mv_data;
+	*size = content.mv_size;
+
+	return 0;
+}
+
+void
+hed_repo_iter_stop(struct hed_repo_iter * iter)
+{
+	hed_assert_api(iter);
+
+	if (iter->cursor && !iter->renew)
+		repo_iter_close(iter);
+}
+
+void
+hed_repo_iter_fini(struct hed_repo_iter * iter)
+{
+	hed_assert_api(iter);
+
+	if (iter->cursor)
+		repo_iter_close(iter);
+}
+
+struct hed_repo_iter *
+hed_repo_tbl_create_iter(struct hed_repo * repo,
+                         unsigned int tbl)
+{
+	return hed_repo_tbl_create_range_iter(repo, tbl, NULL, 0, NULL, 0, 0);
+}
+
+struct hed_repo_iter *
+hed_repo_tbl_create_range_iter(struct hed_repo * repo,
+                               unsigned int tbl,
+                               const uint8_t * lo,
+                               size_t llen,
+                               const uint8_t * hi,
+                               size_t hlen,
+                               unsigned int flags)
+{
+	struct hed_repo_iter *iter;
+
+	iter = malloc(sizeof(*iter));
+	if (!iter)
+		return NULL;
+
+	hed_repo_iter_init(iter);
+	return repo_iter_release(iter,
+	                         hed_repo_tbl_iter_range(iter, repo, tbl,
+	                                                 lo, llen, hi, hlen,
+	                                                 flags));
+}
+
+struct hed_repo_iter *
+hed_repo_tbl_create_prefix_iter(struct hed_repo * repo,
+                                unsigned int tbl,
+                                const uint8_t * prefix,
+                                size_t plen,
+                                unsigned int flags)
+{
+	struct hed_repo_iter *iter;
+
+	iter = malloc(sizeof(*iter));
+	if (!iter)
+		return NULL;
+
+	hed_repo_iter_init(iter);
+	return repo_iter_release(iter,
+	                         hed_repo_tbl_iter_prefix(iter, repo, tbl,
+	                                                  prefix, plen,
+	                                                  flags));
+}
+
+struct hed_repo_iter *
+hed_repo_create_iter(struct hed_repo * repo,
+                     const char * table)
+{
+	hed_assert_api(repo);
+	hed_assert_api(table);
+
+	int tbl;
+
+	tbl = repo_lookup_table(repo, table);
+	if (tbl < 0)
+		return NULL;
+
+	return hed_repo_tbl_create_iter(repo, (unsigned int)tbl);
+}
+
+void
+hed_repo_destroy_iter(struct hed_repo_iter *iter)
+{
+	hed_assert_api(iter);
+	hed_assert_api(iter->cursor);
+
+	hed_repo_iter_fini(iter);
+	free(iter);
+}
+
+int
+hed_repo_step(struct hed_repo_iter * iter,
+              uint8_t * * const key,
+              size_t  * klen,
+              uint8_t * * const value,
+              size_t * vlen)
+{
+	hed_assert_api(iter);
+	hed_assert_api(iter->cursor);
+	hed_assert_api(!!key | !!value);
+	hed_assert_api(!(!!key ^ !!klen));
+	hed_assert_api(!(!!value ^ !!vlen));
+
+	MDB_val idx;
+	MDB_val content;
+	int ret;
+
+	ret = mdb_cursor_get(iter->cursor, &idx, &content, MDB_GET_CURRENT);
+	if (ret)
+		return -EINVAL;
+
+	if (key) {
+		*key  = idx.mv_data;
+		*klen = idx.mv_size;
+	}
+
+	if (value) {
+		*value = content.mv_data;
+		*vlen  = content.mv_size;
+	}
+
+	ret = mdb_cursor_get(iter->cursor, &idx, &content, iter->step);
+	if (ret == MDB_NOTFOUND)
+		return 0;
+
+	if (ret)
+		return -EINVAL;
+
+	return repo_iter_in_range(iter, &idx) ? EAGAIN : 0;
+}
+
+int
+hed_repo_tbl_get_secondary(struct hed_repo * repo,
+                           unsigned int tbl,
+                           const uint8_t * ikey,
+                           size_t iklen,
+                           uint8_t * * const key,
+                           size_t * klen,
+                           uint8_t * * const value,
+                           size_t * vlen)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(repo->txn || repo->log.lost);
+	hed_assert_api(hed_repo_tbl_secondary(repo, tbl));
+	hed_assert_api(ikey);
+	hed_assert_api(iklen > 0);
+	hed_assert_api(key);
+	hed_assert_api(klen);
+	hed_assert_api(!(!!value ^ !!vlen));
+
+	int ret;
+
+	if (repo->log.lost)
+		return MDB_BAD_TXN;
+
+	repo_count_get(repo, 1);
+
+	/* First duplicate, i.e. the lowest primary key. */
+	ret = repo_get(repo->txn, repo->dbi[tbl], ikey, iklen, key, klen);
+	if (ret || !value)
+		return ret;
+
+	repo_count_get(repo, 1);
+
+	return repo_get(repo->txn, repo->dbi[repo->desc[tbl].primary],
+	                *key, *klen, value, vlen);
+}
+
+int
+hed_repo_step_secondary(struct hed_repo_iter * iter,
+                        uint8_t * * const key,
+                        size_t * klen,
+                        uint8_t * * const value,
+                        size_t * vlen)
+{
+	hed_assert_api(iter);
+	hed_assert_api(iter->cursor);
+	hed_assert_api(iter->flags & REPO_ITER_INDEX);
+	hed_assert_api(key);
+	hed_assert_api(klen);
+	hed_assert_api(!(!!value ^ !!vlen));
+
+	int step;
+	int ret;
+
+	step = hed_repo_step(iter, NULL, NULL, key, klen);
+	if ((step < 0) || !value)
+		return step;
+
+	ret = repo_get(mdb_cursor_txn(iter->cursor), iter->primary,
+	               *key, *klen, value, vlen);
+	if (ret == MDB_NOTFOUND)
+		/* Dangling index entry. */
+		return -ENOENT;
+	if (ret)
+		return -EINVAL;
+
+	return step;
+}
+
+int
+hed_repo_read_begin(struct hed_repo * repo,
+                    struct hed_repo_snap * * snap)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(snap);
+
+	struct hed_repo_snap *rd;
+	int ret;
+
+	pthread_mutex_lock(&repo->snap_lock);
+	rd = repo->snap_pool;
+	if (rd)
+		repo->snap_pool = rd->next;
+	repo->snap_nr++;
+	pthread_mutex_unlock(&repo->snap_lock);
+
+	if (rd) {
+		ret = mdb_txn_renew(rd->txn);
+		if (!ret)
+			goto out;
+
+		mdb_txn_abort(rd->txn);
+	}
+	else {
+		rd = malloc(sizeof(*rd));
+		if (!rd) {
+			ret = -ENOMEM;
+			goto unref;
+		}
+	}
+
+	rd->repo = repo;
+	ret = mdb_txn_begin(repo->env, NULL, MDB_RDONLY, &rd->txn);
+	if (ret)
+		goto free;
+
+out:
+	*snap = rd;
+	return 0;
+
+free:
+	free(rd);
+unref:
+	pthread_mutex_lock(&repo->snap_lock);
+	repo->snap_nr--;
+	pthread_mutex_unlock(&repo->snap_lock);
+	return ret;
+}
+
+void
+hed_repo_read_end(struct hed_repo_snap * snap)
+{
+	hed_assert_api(snap);
+	hed_assert_api(snap->repo);
+	hed_assert_api(snap->txn);
+
+	struct hed_repo *repo = snap->repo;
+
+	/* Release the snapshot but keep the reader slot for later reuse. */
+	mdb_txn_reset(snap->txn);
+
+	pthread_mutex_lock(&repo->snap_lock);
+	hed_assert_intern(repo->snap_nr);
+	snap->next = repo->snap_pool;
+	repo->snap_pool = snap;
+	repo->snap_nr--;
+	pthread_mutex_unlock(&repo->snap_lock);
+}
+
+int
+hed_repo_snap_get(struct hed_repo_snap * snap,
+                  unsigned int tbl,
+                  const uint8_t * key,
+                  size_t klen,
+                  uint8_t * * const value,
+                  size_t * vlen)
+{
+	hed_assert_api(snap);
+	hed_assert_api(snap->txn);
+	hed_assert_api(tbl <= HED_REPO_META_TBL(snap->repo));
+	hed_assert_api(key);
+	hed_assert_api(klen > 0);
+	hed_assert_api(value);
+	hed_assert_api(vlen);
+
+	repo_count_get(snap->repo, 1);
+
+	return repo_get(snap->txn, snap->repo->dbi[tbl],
+	                key, klen, value, vlen);
+}
+
+int
+hed_repo_snap_get_many(struct hed_repo_snap * snap,
+                       unsigned int tbl,
+                       struct hed_repo_item * items,
+                       size_t nr)
+{
+	hed_assert_api(snap);
+	hed_assert_api(snap->txn);
+	hed_assert_api(tbl <= HED_REPO_META_TBL(snap->repo));
+	hed_assert_api(items);
+
+	repo_count_get(snap->repo, nr);
+
+	return repo_get_many(snap->txn, snap->repo->dbi[tbl], items, nr);
+}
+
+ssize_t
+hed_repo_snap_count(struct hed_repo_snap * snap,
+                    unsigned int tbl)
+{
+	hed_assert_api(snap);
+	hed_assert_api(snap->txn);
+	hed_assert_api(tbl <= HED_REPO_META_TBL(snap->repo));
+
+	MDB_stat stat;
+	int ret;
+
+	ret = mdb_stat(snap->txn, snap->repo->dbi[tbl], &stat);
+	if (ret)
+		return repo_count_error(ret);
+
+	return (ssize_t)stat.ms_entries;
+}
+
+int
+hed_repo_snap_iter_range(struct hed_repo_iter * iter,
+                         struct hed_repo_snap * snap,
+                         unsigned int tbl,
+                         const uint8_t * lo,
+                         size_t llen,
+                         const uint8_t * hi,
+                         size_t hlen,
+                         unsigned int flags)
+{
+	hed_assert_api(iter);
+	hed_assert_api(snap);
+	hed_assert_api(snap->txn);
+	hed_assert_api(tbl <= HED_REPO_META_TBL(snap->repo));
+	hed_assert_api(!lo || llen);
+	hed_assert_api(!hi || hlen);
+	hed_assert_api(!(flags & ~HED_REPO_ITER_REVERSE));
+
+	return repo_iter_range(iter, snap->repo, snap->txn,
+	                       snap->repo->dbi[tbl],
+	                       lo, llen, hi, hlen, flags, true);
+}
+
+int
+hed_repo_snap_iter_prefix(struct hed_repo_iter * iter,
+                          struct hed_repo_snap * snap,
+                          unsigned int tbl,
+                          const uint8_t * prefix,
+                          size_t plen,
+                          unsigned int flags)
+{
+	hed_assert_api(iter);
+	hed_assert_api(snap);
+	hed_assert_api(snap->txn);
+	hed_assert_api(tbl <= HED_REPO_META_TBL(snap->repo));
+	/* Native integers do not sort bytewise. */
+	hed_assert_api(!hed_repo_tbl_intkey(snap->repo, tbl));
+	hed_assert_api(prefix);
+	hed_assert_api(plen > 0);
+	hed_assert_api(!(flags & ~HED_REPO_ITER_REVERSE));
+
+	return repo_iter_prefix(iter, snap->repo, snap->txn,
+	                        snap->repo->dbi[tbl],
+	                        prefix, plen, flags, true);
+}
+
+struct hed_repo_iter *
+hed_repo_snap_create_iter(struct hed_repo_snap * snap,
+                          unsigned int tbl)
+{
+	return hed_repo_snap_create_range_iter(snap, tbl,
+	                                       NULL, 0, NULL, 0, 0);
+}
+
+struct hed_repo_iter *
+hed_repo_snap_create_range_iter(struct hed_repo_snap * snap,
+                                unsigned int tbl,
+                                const uint8_t * lo,
+                                size_t llen,
+                                const uint8_t * hi,
+                                size_t hlen,
+                                unsigned int flags)
+{
+	struct hed_repo_iter *iter;
+
+	iter = malloc(sizeof(*iter));
+	if (!iter)
+		return NULL;
+
+	hed_repo_iter_init(iter);
+	return repo_iter_release(iter,
+	                         hed_repo_snap_iter_range(iter, snap, tbl,
+	                                                  lo, llen, hi, hlen,
+	                                                  flags));
+}
+
+struct hed_repo_iter *
+hed_repo_snap_create_prefix_iter(struct hed_repo_snap * snap,
+                                 unsigned int tbl,
+                                 const uint8_t * prefix,
+                                 size_t plen,
+                                 unsigned int flags)
+{
+	struct hed_repo_iter *iter;
+
+	iter = malloc(sizeof(*iter));
+	if (!iter)
+		return NULL;
+
+	hed_repo_iter_init(iter);
+	return repo_iter_release(iter,
+	                         hed_repo_snap_iter_prefix(iter, snap, tbl,
+	                                                   prefix, plen,
+	                                                   flags));
+}
+
+struct hed_repo_bulk_ent {
+	size_t koff;
+	size_t klen;
+	size_t vlen;
+};
+
+static int __hed_nonull(1, 2, 3)
+repo_bulk_cmp(const void * first, const void * second, void * data)
+{
+	hed_assert_intern(first);
+	hed_assert_intern(second);
+	hed_assert_intern(data);
+
+	const struct hed_repo_bulk_ent *a = first;
+	const struct hed_repo_bulk_ent *b = second;
+	const struct hed_repo_bulk *bulk = data;
+	MDB_val ka = {
+		.mv_data = &bulk->data[a->koff],
+		.mv_size = a->klen
+	};
+	MDB_val kb = {
+		.mv_data = &bulk->data[b->koff],
+		.mv_size = b->klen
+	};
+	int ret;
+
+	ret = mdb_cmp(bulk->repo->txn, bulk->repo->dbi[bulk->tbl], &ka, &kb);
+	if (ret)
+		return ret;
+
+	/* Keep insertion order of duplicate keys so that the last one wins. */
+	return (a->koff > b->koff) - (a->koff < b->koff);
+}
+
+static int __hed_nonull(1, 2, 3)
+repo_bulk_put(struct hed_repo_bulk * bulk, MDB_val * idx, MDB_val * content)
+{
+	hed_assert_intern(bulk);
+	hed_assert_intern(bulk->repo->txn || bulk->repo->log.lost);
+	hed_assert_intern(idx);
+	hed_assert_intern(content);
+
+	int ret;
+
+	if (bulk->repo->log.lost)
+		return MDB_BAD_TXN;
+
+#if defined(CONFIG_HED_REPO_3PC)
+	ret = repo_undo_record(bulk->repo, bulk->tbl, idx);
+	if (ret)
+		return ret;
+#endif
+
+	ret = repo_index_sync(bulk->repo, bulk->tbl, idx, content, false);
+	if (ret)
+		return ret;
+
+	ret = repo_put(bulk->repo, bulk->tbl, idx, content,
+	               hed_repo_tbl_dup(bulk->repo, bulk->tbl) ?
+	               MDB_APPENDDUP : MDB_APPEND);
+	if (ret != MDB_KEYEXIST)
+		return ret;
+
+	/* Key does not sort after the table's last one: regular insertion. */
+	return repo_put(bulk->repo, bulk->tbl, idx, content, 0);
+}
+
+static int __hed_nonull(1)
+repo_bulk_flush(struct hed_repo_bulk * bulk)
+{
+	hed_assert_intern(bulk);
+	hed_assert_intern(bulk->flags & HED_REPO_BULK_SORT);
+
+	size_t i;
+	int ret;
+	MDB_val idx;
+	MDB_val content;
+
+	qsort_r(bulk->ent, bulk->nr, sizeof(bulk->ent[0]), repo_bulk_cmp, bulk);
+
+	for (i = 0; i < bulk->nr; i++) {
+		idx.mv_data = &bulk->data[bulk->ent[i].koff];
+		idx.mv_size = bulk->ent[i].klen;
+		content.mv_data = &bulk->data[bulk->ent[i].koff +
+		                              bulk->ent[i].klen];
+		content.mv_size = bulk->ent[i].vlen;
+
+		ret = repo_bulk_put(bulk, &idx, &content);
+		if (ret)
+			return ret;
+	}
+
+	bulk->nr = 0;
+	bulk->used = 0;
+	return 0;
+}
+
+static int __hed_nonull(1)
+repo_bulk_commit(struct hed_repo_bulk * bulk)
+{
+	hed_assert_intern(bulk);
+	hed_assert_intern(bulk->repo->txn || bulk->repo->log.lost);
+
+	int ret;
+
+	if (bulk->flags & HED_REPO_BULK_SORT) {
+		ret = repo_bulk_flush(bulk);
+		if (ret)
+			return ret;
+	}
+	else
+		bulk->nr = 0;
+
+	return hed_repo_commit(bulk->repo);
+}
+
+static int __hed_nonull(1)
+repo_bulk_start(struct hed_repo_bulk * bulk)
+{
+	hed_assert_intern(bulk);
+	hed_assert_intern(!bulk->repo->txn);
+
+	return hed_repo_start(bulk->repo);
+}
+
+int
+hed_repo_bulk_begin(struct hed_repo_bulk * bulk,
+                    struct hed_repo * repo,
+                    unsigned int tbl,
+                    size_t batch,
+                    unsigned int flags)
 {
+	hed_assert_api(bulk);
 	hed_assert_api(repo);
 	hed_assert_api(repo->env);
-	hed_assert_api(repo->txn);
-	hed_assert_api(table);
+	hed_assert_api(!repo->txn);
+	hed_assert_api(tbl <= HED_REPO_META_TBL(repo));
+	hed_assert_api(!hed_repo_tbl_secondary(repo, tbl));
+	hed_assert_api(batch > 0);
+	hed_assert_api(!(flags & ~HED_REPO_BULK_SORT));
+
+	int ret;
+
+	bulk->repo = repo;
+	bulk->tbl = tbl;
+	bulk->flags = flags;
+	bulk->batch = batch;
+	bulk->nr = 0;
+	bulk->ent = NULL;
+	bulk->data = NULL;
+	bulk->used = 0;
+	bulk->capa = 0;
+
+	if (flags & HED_REPO_BULK_SORT) {
+		bulk->ent = malloc(batch * sizeof(bulk->ent[0]));
+		if (!bulk->ent)
+			return -ENOMEM;
+	}
+
+	ret = repo_bulk_start(bulk);
+	if (ret)
+		free(bulk->ent);
+
+	return ret;
+}
+
+int
+hed_repo_bulk_add(struct hed_repo_bulk * bulk,
+                  const uint8_t * key,
+                  size_t klen,
+                  const uint8_t * value,
+                  size_t vlen)
+{
+	hed_assert_api(bulk);
+	hed_assert_api(bulk->repo);
+	hed_assert_api(bulk->repo->txn || bulk->repo->log.lost);
 	hed_assert_api(key);
 	hed_assert_api(klen > 0);
 	hed_assert_api(value);
 	hed_assert_api(vlen > 0);
 
 	int ret;
-	MDB_dbi dbi;
+
+	if (bulk->nr == bulk->batch) {
+		ret = repo_bulk_commit(bulk);
+		if (ret)
+			return ret;
+
+		ret = repo_bulk_start(bulk);
+		if (ret)
+			return ret;
+	}
+
+	if (!(bulk->flags & HED_REPO_BULK_SORT)) {
+STROLL_IGNORE_WARN("-Wcast-qual")
+		MDB_val idx = {
+			.mv_data = (uint8_t *)key,
+			.mv_size = klen
+		};
+		MDB_val content = {
+			.mv_data = (uint8_t *)value,
+			.mv_size = vlen
+		};
+STROLL_RESTORE_WARN
+
+		ret = repo_bulk_put(bulk, &idx, &content);
+		if (ret)
+			return ret;
+
+		bulk->nr++;
+		return 0;
+	}
+
+	if ((bulk->used + klen + vlen) > bulk->capa) {
+		size_t capa = stroll_max(2 * bulk->capa,
+		                         bulk->used + klen + vlen);
+		uint8_t *data;
+
+		data = realloc(bulk->data, capa);
+		if (!data)
+			return -ENOMEM;
+
+		bulk->data = data;
+		bulk->capa = capa;
+	}
+
+	bulk->ent[bulk->nr].koff = bulk->used;
+	bulk->ent[bulk->nr].klen = klen;
+	bulk->ent[bulk->nr].vlen = vlen;
+	memcpy(&bulk->data[bulk->used], key, klen);
+	memcpy(&bulk->data[bulk->used + klen], value, vlen);
+	bulk->used += klen + vlen;
+	bulk->nr++;
+
+	return 0;
+}
+
+int
+hed_repo_bulk_end(struct hed_repo_bulk * bulk)
+{
+	hed_assert_api(bulk);
+	hed_assert_api(bulk->repo);
+	hed_assert_api(bulk->repo->txn || bulk->repo->log.lost);
+
+	int ret;
+
+	ret = repo_bulk_commit(bulk);
+	if (ret && (bulk->repo->txn || bulk->repo->log.lost))
+		hed_repo_abort(bulk->repo);
+
+	free(bulk->ent);
+	free(bulk->data);
+
+	return ret;
+}
+
+void
+hed_repo_bulk_abort(struct hed_repo_bulk * bulk)
+{
+	hed_assert_api(bulk);
+	hed_assert_api(bulk->repo);
+
+	/* Entries of previously committed batches are kept. */
+	if (bulk->repo->txn || bulk->repo->log.lost)
+		hed_repo_abort(bulk->repo);
+
+	free(bulk->ent);
+	free(bulk->data);
+}
+
+/*
+ * Dump records are made of a 32-bit big-endian payload length followed by a
+ * msgpack payload starting with a record tag:
+ * - REPO_DUMP_HEAD: uint32 dump format version, first record;
+ * - REPO_DUMP_TBL: str name of the table following entries belong to;
+ * - REPO_DUMP_ENT: bin key then bin value;
+ * - REPO_DUMP_END: uint64 count of entries dumped, last record.
+ */
+enum repo_dump_tag {
+	REPO_DUMP_HEAD,
+	REPO_DUMP_TBL,
+	REPO_DUMP_ENT,
+	REPO_DUMP_END
+};
+
+#define REPO_DUMP_VERSION  1U
+#define REPO_DUMP_LEN_SIZE sizeof(uint32_t)
+/* Largest msgpack tag, bin / str header or uint64 encoding. */
+#define REPO_DUMP_HDR_MAX  9U
+#define REPO_DUMP_BUF_SIZE (1UL << 20)
+#define REPO_DUMP_REC_MAX  ((size_t)CONFIG_HED_REPO_DUMP_REC_MAX << 20)
+#define REPO_IMPORT_BATCH  8192U
+
+struct repo_dump {
+	int                   fd;
+	uint8_t              *buf;
+	size_t                used;
+	size_t                off;
+	size_t                capa;
+	size_t                nr;
+	size_t                bytes;
+	const char           *table;
+	hed_repo_progress_fn *progress;
+	void                 *data;
+};
+
+static const char * __hed_nonull(1) __warn_result
+repo_tbl_name(const struct hed_repo * repo, unsigned int tbl)
+{
+	hed_assert_intern(repo);
+	hed_assert_intern(tbl <= HED_REPO_META_TBL(repo));
+
+	return (tbl < repo->nb) ? repo->table[tbl] : ".hed";
+}
+
+static int __hed_nonull(1)
+repo_dump_init(struct repo_dump * dump,
+               int fd,
+               hed_repo_progress_fn * progress,
+               void * data)
+{
+	hed_assert_intern(dump);
+	hed_assert_intern(fd >= 0);
+
+	dump->buf = malloc(REPO_DUMP_BUF_SIZE);
+	if (!dump->buf)
+		return -ENOMEM;
+
+	dump->fd = fd;
+	dump->used = 0;
+	dump->off = 0;
+	dump->capa = REPO_DUMP_BUF_SIZE;
+	dump->nr = 0;
+	dump->bytes = 0;
+	dump->table = NULL;
+	dump->progress = progress;
+	dump->data = data;
+
+	return 0;
+}
+
+static int __hed_nonull(1)
+repo_dump_progress(const struct repo_dump * dump)
+{
+	hed_assert_intern(dump);
+
+	if (!dump->progress)
+		return 0;
+
+	return dump->progress(dump->table, dump->nr, dump->bytes, dump->data);
+}
+
+static int __hed_nonull(1)
+repo_dump_flush(struct repo_dump * dump)
+{
+	hed_assert_intern(dump);
+
+	ssize_t ret;
+
+	if (!dump->used)
+		return 0;
+
+	ret = ufile_nointr_full_write(dump->fd,
+	                              (const char *)dump->buf,
+	                              dump->used);
+	if (ret < 0)
+		return (int)ret;
+
+	dump->bytes += dump->used;
+	dump->used = 0;
+
+	return repo_dump_progress(dump);
+}
+
+/* Setup an encoder for a record payload of at most size bytes. */
+static int __hed_nonull(1, 2)
+repo_dump_open(struct repo_dump * dump,
+               struct dpack_encoder * encoder,
+               size_t size)
+{
+	hed_assert_intern(dump);
+	hed_assert_intern(encoder);
+
+	size += REPO_DUMP_LEN_SIZE;
+	if ((dump->capa - dump->used) < size) {
+		int ret;
+
+		ret = repo_dump_flush(dump);
+		if (ret)
+			return ret;
+
+		if (dump->capa < size) {
+			/* Record larger than a buffer, e.g. huge values. */
+			uint8_t *buf;
+
+			buf = realloc(dump->buf, size);
+			if (!buf)
+				return -ENOMEM;
+
+			dump->buf = buf;
+			dump->capa = size;
+		}
+	}
+
+	dpack_encoder_init_buffer(encoder,
+	                          (char *)&dump->buf[dump->used +
+	                                             REPO_DUMP_LEN_SIZE],
+	                          dump->capa - dump->used - REPO_DUMP_LEN_SIZE);
+
+	return 0;
+}
+
+/* Commit the record being encoded, unless an encoding error happened. */
+static int __hed_nonull(1, 2)
+repo_dump_close(struct repo_dump * dump,
+                struct dpack_encoder * encoder,
+                int status)
+{
+	hed_assert_intern(dump);
+	hed_assert_intern(encoder);
+
+	uint32_t len;
+
+	if (status) {
+		dpack_encoder_fini(encoder, DPACK_ABORT);
+		return status;
+	}
+
+	len = htobe32((uint32_t)dpack_encoder_space_used(encoder));
+	dpack_encoder_fini(encoder, DPACK_DONE);
+
+	memcpy(&dump->buf[dump->used], &len, sizeof(len));
+	dump->used += REPO_DUMP_LEN_SIZE + be32toh(len);
+
+	return 0;
+}
+
+static int __hed_nonull(1, 2, 3)
+repo_export_tbl(struct repo_dump * dump,
+                struct hed_repo * repo,
+                MDB_txn * txn,
+                unsigned int tbl)
+{
+	hed_assert_intern(dump);
+	hed_assert_intern(repo);
+	hed_assert_intern(txn);
+	hed_assert_intern(tbl <= HED_REPO_META_TBL(repo));
+
+	struct dpack_encoder encoder;
+	MDB_cursor *cursor;
+	MDB_val idx;
+	MDB_val content;
+	int ret;
+
+	dump->table = repo_tbl_name(repo, tbl);
+
+	ret = repo_dump_open(dump,
+	                     &encoder,
+	                     2 * REPO_DUMP_HDR_MAX + strlen(dump->table));
+	if (ret)
+		return ret;
+
+	ret = dpack_encode_uint8(&encoder, REPO_DUMP_TBL);
+	if (!ret)
+		ret = dpack_encode_str(&encoder, dump->table);
+	ret = repo_dump_close(dump, &encoder, ret);
+	if (ret)
+		return ret;
+
+	ret = mdb_cursor_open(txn, repo->dbi[tbl], &cursor);
+	if (ret)
+		return ret;
+
+	for (ret = mdb_cursor_get(cursor, &idx, &content, MDB_FIRST);
+	     !ret;
+	     ret = mdb_cursor_get(cursor, &idx, &content, MDB_NEXT)) {
+		size_t size = 3 * REPO_DUMP_HDR_MAX + idx.mv_size +
+		              content.mv_size;
+
+		if (size > REPO_DUMP_REC_MAX) {
+			/* Importing would refuse it. */
+			ret = -EMSGSIZE;
+			break;
+		}
+
+		ret = repo_dump_open(dump, &encoder, size);
+		if (ret)
+			break;
+
+		ret = dpack_encode_uint8(&encoder, REPO_DUMP_ENT);
+		if (!ret)
+			ret = dpack_encode_bin(&encoder,
+			                       idx.mv_data,
+			                       idx.mv_size);
+		if (!ret)
+			ret = dpack_encode_bin(&encoder,
+			                       content.mv_data,
+			                       content.mv_size);
+		ret = repo_dump_close(dump, &encoder, ret);
+		if (ret)
+			break;
+
+		dump->nr++;
+	}
+
+	mdb_cursor_close(cursor);
+
+	return (ret == MDB_NOTFOUND) ? 0 : ret;
+}
+
+int
+hed_repo_export(struct hed_repo * repo,
+                unsigned int tbl,
+                int fd,
+                hed_repo_progress_fn * progress,
+                void * data)
+{
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api((tbl <= HED_REPO_META_TBL(repo)) ||
+	               (tbl == HED_REPO_TBL_ALL));
+	hed_assert_api(fd >= 0);
+
+	struct repo_dump dump;
+	struct dpack_encoder encoder;
+	MDB_txn *txn = repo->txn;
+	unsigned int t;
+	int ret;
+
+	ret = repo_dump_init(&dump, fd, progress, data);
+	if (ret)
+		return ret;
+
+	if (!txn) {
+		ret = mdb_txn_begin(repo->env, NULL, MDB_RDONLY, &txn);
+		if (ret)
+			goto free;
+	}
+
+	ret = repo_dump_open(&dump, &encoder, 2 * REPO_DUMP_HDR_MAX);
+	if (ret)
+		goto abort;
+
+	ret = dpack_encode_uint8(&encoder, REPO_DUMP_HEAD);
+	if (!ret)
+		ret = dpack_encode_uint32(&encoder, REPO_DUMP_VERSION);
+	ret = repo_dump_close(&dump, &encoder, ret);
+	if (ret)
+		goto abort;
+
+	if (tbl == HED_REPO_TBL_ALL) {
+		for (t = 0; t <= HED_REPO_META_TBL(repo); t++) {
+			ret = repo_export_tbl(&dump, repo, txn, t);
+			if (ret)
+				goto abort;
+		}
+	}
+	else {
+		ret = repo_export_tbl(&dump, repo, txn, tbl);
+		if (ret)
+			goto abort;
+	}
+
+	ret = repo_dump_open(&dump, &encoder, 2 * REPO_DUMP_HDR_MAX);
+	if (ret)
+		goto abort;
+
+	ret = dpack_encode_uint8(&encoder, REPO_DUMP_END);
+	if (!ret)
+		ret = dpack_encode_uint64(&encoder, dump.nr);
+	ret = repo_dump_close(&dump, &encoder, ret);
+	if (ret)
+		goto abort;
+
+	ret = repo_dump_flush(&dump);
+
+abort:
+	if (txn != repo->txn)
+		mdb_txn_abort(txn);
+free:
+	free(dump.buf);
+
+	return ret;
+}
+
+/* Make sure size bytes of dump are buffered, reading more when needed. */
+static int __hed_nonull(1)
+repo_dump_fill(struct repo_dump * dump, size_t size)
+{
+	hed_assert_intern(dump);
+
+	while ((dump->used - dump->off) < size) {
+		ssize_t ret;
+
+		if (dump->off) {
+			dump->used -= dump->off;
+			memmove(dump->buf, &dump->buf[dump->off], dump->used);
+			dump->off = 0;
+		}
+
+		if (dump->capa < size) {
+			uint8_t *buf;
+
+			buf = realloc(dump->buf, size);
+			if (!buf)
+				return -ENOMEM;
+
+			dump->buf = buf;
+			dump->capa = size;
+		}
+
+		ret = ufile_nointr_read(dump->fd,
+		                        (char *)&dump->buf[dump->used],
+		                        dump->capa - dump->used);
+		if (ret < 0)
+			return (int)ret;
+		if (!ret)
+			/* Truncated dump. */
+			return -EBADMSG;
+
+		dump->used += (size_t)ret;
+		dump->bytes += (size_t)ret;
+
+		ret = repo_dump_progress(dump);
+		if (ret)
+			return (int)ret;
+	}
+
+	return 0;
+}
+
+struct repo_import {
+	struct hed_repo      *repo;
+	struct hed_repo_bulk  bulk;
+	bool                  loading;
+	bool                  skip;
+	bool                  meta;
+	bool                  head;
+	bool                  end;
+	uint8_t              *value;
+	size_t                vcapa;
+};
+
+static int __hed_nonull(1, 2, 3)
+repo_import_tbl(struct repo_import * imp,
+                struct repo_dump * dump,
+                struct dpack_decoder * decoder)
+{
+	hed_assert_intern(imp);
+	hed_assert_intern(dump);
+	hed_assert_intern(decoder);
+
+	char *name;
+	ssize_t len;
+	int tbl;
+	int ret;
+
+	len = dpack_decode_strdup(decoder, &name);
+	if (len < 0)
+		return (int)len;
+
+	tbl = repo_lookup_table(imp->repo, name);
+	free(name);
+	if (tbl < 0)
+		return tbl;
+
+	if (imp->loading) {
+		imp->loading = false;
+		ret = hed_repo_bulk_end(&imp->bulk);
+		if (ret)
+			return ret;
+	}
+
+	dump->table = repo_tbl_name(imp->repo, (unsigned int)tbl);
+
+	/* Secondary indexes follow their primary table entries. */
+	imp->skip = hed_repo_tbl_secondary(imp->repo, (unsigned int)tbl);
+	if (imp->skip)
+		return 0;
+
+	ret = hed_repo_bulk_begin(&imp->bulk,
+	                          imp->repo,
+	                          (unsigned int)tbl,
+	                          REPO_IMPORT_BATCH,
+	                          0);
+	if (ret)
+		return ret;
+
+	imp->loading = true;
+	if ((unsigned int)tbl == HED_REPO_META_TBL(imp->repo))
+		imp->meta = true;
+
+	return 0;
+}
+
+/*
+ * Keep the highest of existing and imported sequence high-water marks so that
+ * importing an older dump never hands sequence numbers out twice.
+ */
+static int __hed_nonull(1, 2, 4)
+repo_import_seq(struct repo_import * imp,
+                const uint8_t * key,
+                size_t klen,
+                uint8_t * value,
+                size_t vlen)
+{
+	hed_assert_intern(imp);
+	hed_assert_intern(imp->repo->txn);
+	hed_assert_intern(key);
+	hed_assert_intern(klen);
+	hed_assert_intern(value);
+
+	uint32_t hwm;
+	uint32_t cur;
+	MDB_val content;
+	int ret;
 STROLL_IGNORE_WARN("-Wcast-qual")
 	MDB_val idx = {
 		.mv_data = (uint8_t *)key,
 		.mv_size = klen
 	};
-	MDB_val content = {
-		.mv_data = (uint8_t *)value,
-		.mv_size = vlen
-	};
 STROLL_RESTORE_WARN
 
-	ret = mdb_dbi_open(repo->txn, table, 0, &dbi);
+	if (vlen != sizeof(hwm))
+		return -EBADMSG;
+
+	ret = mdb_get(imp->repo->txn,
+	              imp->repo->dbi[HED_REPO_META_TBL(imp->repo)],
+	              &idx,
+	              &content);
 	if (ret)
-		return ret;
+		return (ret == MDB_NOTFOUND) ? 0 : ret;
 
-	return mdb_put(repo->txn, dbi, &idx, &content, 0);
+	hed_assert_intern(content.mv_size == sizeof(cur));
+	memcpy(&cur, content.mv_data, sizeof(cur));
+	memcpy(&hwm, value, sizeof(hwm));
+	if (cur > hwm)
+		memcpy(value, &cur, sizeof(cur));
+
+	return 0;
 }
 
+static int __hed_nonull(1, 2, 3)
+repo_import_ent(struct repo_import * imp,
+                struct repo_dump * dump,
+                struct dpack_decoder * decoder)
+{
+	hed_assert_intern(imp);
+	hed_assert_intern(dump);
+	hed_assert_intern(decoder);
 
-int
-hed_repo_del(struct hed_repo * repo,
-                const char * table,
-                const uint8_t * key,
-                size_t klen)
+	uint8_t key[HED_REPO_KEY_MAX];
+	ssize_t klen;
+	ssize_t vlen;
+	size_t left = dpack_decoder_data_left(decoder);
+	int ret;
+
+	if (!imp->loading && !imp->skip)
+		return -EBADMSG;
+
+	/* The value cannot be larger than what is left of the record. */
+	if (left > imp->vcapa) {
+		uint8_t *value;
+
+		value = realloc(imp->value, left);
+		if (!value)
+			return -ENOMEM;
+
+		imp->value = value;
+		imp->vcapa = left;
+	}
+
+	klen = dpack_decode_bincpy(decoder, sizeof(key), (char *)key);
+	if (klen < 0)
+		return (int)klen;
+
+	vlen = dpack_decode_bincpy(decoder, imp->vcapa, (char *)imp->value);
+	if (vlen < 0)
+		return (int)vlen;
+
+	if (!klen || !vlen)
+		return -EBADMSG;
+
+	if (!imp->skip) {
+		if (imp->bulk.tbl == HED_REPO_META_TBL(imp->repo)) {
+			ret = repo_import_seq(imp, key, (size_t)klen,
+			                      imp->value, (size_t)vlen);
+			if (ret)
+				return ret;
+		}
+
+		ret = hed_repo_bulk_add(&imp->bulk,
+		                        key,
+		                        (size_t)klen,
+		                        imp->value,
+		                        (size_t)vlen);
+		if (ret)
+			return ret;
+	}
+
+	dump->nr++;
+
+	return 0;
+}
 
+static int __hed_nonull(1, 2)
+repo_import_rec(struct repo_import * imp, struct repo_dump * dump)
 {
-	hed_assert_api(repo);
-	hed_assert_api(repo->env);
-	hed_assert_api(repo->txn);
-	hed_assert_api(table);
-	hed_assert_api(key);
-	hed_assert_api(klen > 0);
+	hed_assert_intern(imp);
+	hed_assert_intern(dump);
 
+	struct dpack_decoder decoder;
+	uint32_t len;
+	uint8_t tag;
+	uint32_t vers;
+	uint64_t nr;
 	int ret;
-	MDB_dbi dbi;
-STROLL_IGNORE_WARN("-Wcast-qual")
-	MDB_val idx = {
-		.mv_data = (uint8_t *)key,
-		.mv_size = klen
-	};
-STROLL_RESTORE_WARN
 
-	ret = mdb_dbi_open(repo->txn, table, 0, &dbi);
+	ret = repo_dump_fill(dump, REPO_DUMP_LEN_SIZE);
+	if (ret)
+		return ret;
+
+	memcpy(&len, &dump->buf[dump->off], sizeof(len));
+	len = be32toh(len);
+	dump->off += REPO_DUMP_LEN_SIZE;
+	if (!len || (len > REPO_DUMP_REC_MAX))
+		/* Do not let a corrupt length allocate unbounded memory. */
+		return -EBADMSG;
+
+	ret = repo_dump_fill(dump, len);
 	if (ret)
 		return ret;
 
-	return mdb_del(repo->txn, dbi, &idx, NULL);
+	dpack_decoder_init_buffer(&decoder,
+	                          (const char *)&dump->buf[dump->off],
+	                          len);
+	dump->off += len;
+
+	ret = dpack_decode_uint8(&decoder, &tag);
+	if (ret)
+		goto fini;
+
+	if (!imp->head && (tag != REPO_DUMP_HEAD)) {
+		ret = -EBADMSG;
+		goto fini;
+	}
+
+	switch (tag) {
+	case REPO_DUMP_HEAD:
+		if (imp->head) {
+			ret = -EBADMSG;
+			break;
+		}
+		ret = dpack_decode_uint32(&decoder, &vers);
+		if (!ret && (vers != REPO_DUMP_VERSION))
+			ret = -ENOTSUP;
+		imp->head = true;
+		break;
+
+	case REPO_DUMP_TBL:
+		ret = repo_import_tbl(imp, dump, &decoder);
+		break;
+
+	case REPO_DUMP_ENT:
+		ret = repo_import_ent(imp, dump, &decoder);
+		break;
+
+	case REPO_DUMP_END:
+		ret = dpack_decode_uint64(&decoder, &nr);
+		if (!ret && (nr != dump->nr))
+			ret = -EBADMSG;
+		imp->end = true;
+		break;
+
+	default:
+		ret = -EBADMSG;
+	}
+
+	if (!ret && dpack_decoder_data_left(&decoder))
+		ret = -EBADMSG;
+
+fini:
+	dpack_decoder_fini(&decoder);
+
+	return ret;
 }
 
-ssize_t
-hed_repo_count(struct hed_repo * repo,
-               const char * table)
+int
+hed_repo_import(struct hed_repo * repo,
+                int fd,
+                hed_repo_progress_fn * progress,
+                void * data)
 {
 	hed_assert_api(repo);
 	hed_assert_api(repo->env);
-	hed_assert_api(repo->txn);
-	hed_assert_api(table);
+	hed_assert_api(!repo->txn);
+	hed_assert_api(fd >= 0);
 
-	MDB_dbi dbi;
-	MDB_stat stat;
-	ssize_t ret;
+	struct repo_dump dump;
+	struct repo_import imp = {
+		.repo    = repo,
+		.loading = false,
+		.skip    = false,
+		.meta    = false,
+		.head    = false,
+		.end     = false,
+		.value   = NULL,
+		.vcapa   = 0
+	};
+	int ret;
 
-	ret = mdb_dbi_open(repo->txn, table, 0, &dbi);
+	ret = repo_dump_init(&dump, fd, progress, data);
 	if (ret)
-		return -ret;
+		return ret;
 
-	ret = mdb_stat(repo->txn, dbi, &stat);
-	if (ret)
-		return -ret;
+	do {
+		ret = repo_import_rec(&imp, &dump);
+	} while (!ret && !imp.end);
 
-	return (ssize_t)stat.ms_entries;
+	if (imp.loading) {
+		if (!ret)
+			ret = hed_repo_bulk_end(&imp.bulk);
+		else
+			hed_repo_bulk_abort(&imp.bulk);
+	}
+
+	/* Sequence blocks cached so far may predate imported high marks. */
+	if (imp.meta)
+		repo_seq_reset(repo);
+
+	free(imp.value);
+	free(dump.buf);
+
+	return ret;
 }
 
-uint32_t
-hed_repo_next_seq(struct hed_repo * repo,
-                  const char * table)
+/*
+ * Ranges handed out per scan worker: workers pull ranges as they go so that
+ * ranges of uneven sizes still spread evenly.
+ */
+#define REPO_SCAN_SPLIT 4U
+/* Minimum count of entries per range. */
+#define REPO_SCAN_MIN   1024U
+/* Attempts at starting worker transactions on the same snapshot. */
+#define REPO_SCAN_RETRY 8U
+/* Bytes of key interpolated when splitting key space. */
+#define REPO_SCAN_WORD  sizeof(uint64_t)
+
+/* Range i spans keys from bound[i - 1] included up to bound[i] excluded. */
+struct repo_scan {
+	MDB_dbi           dbi;
+	bool              intkey;
+	MDB_val          *bound;
+	uint8_t          *keys;
+	unsigned int      range_nr;
+	unsigned int      next;
+	int               status;
+	hed_repo_scan_fn *fn;
+	void             *data;
+};
+
+struct repo_scan_worker {
+	struct repo_scan *scan;
+	MDB_txn          *txn;
+	unsigned int      id;
+	pthread_t         thread;
+};
+
+static int __hed_nonull(1, 2, 3)
+repo_scan_cmp(const void * first, const void * second, void * data)
 {
-	hed_assert_api(repo);
-	hed_assert_api(repo->env);
-	hed_assert_api(repo->txn);
-	hed_assert_api(table);
+	hed_assert_intern(first);
+	hed_assert_intern(second);
+	hed_assert_intern(data);
+
+	const struct repo_many_ctx *ctx = data;
 
+STROLL_IGNORE_WARN("-Wcast-qual")
+	return mdb_cmp(ctx->txn, ctx->dbi, (MDB_val *)first, (MDB_val *)second);
+STROLL_RESTORE_WARN
+}
+
+/* Big-endian integer made of n key bytes found past prefix. */
+static uint64_t __hed_nonull(1) __warn_result
+repo_scan_word(const MDB_val * key, size_t plen, size_t n)
+{
+	hed_assert_intern(key);
+	hed_assert_intern(n <= REPO_SCAN_WORD);
+
+	const uint8_t *data = key->mv_data;
+	uint64_t word = 0;
+	size_t b;
+
+	for (b = 0; b < n; b++)
+		word = (word << 8) |
+		       (((plen + b) < key->mv_size) ? data[plen + b] : 0);
+
+	return word;
+}
+
+/* Value of a native unsigned int or size_t integer key. */
+static uint64_t __hed_nonull(1) __warn_result
+repo_scan_int(const MDB_val * key)
+{
+	hed_assert_intern(key);
+
+	unsigned int i;
+	size_t z;
+
+	if (key->mv_size == sizeof(i)) {
+		memcpy(&i, key->mv_data, sizeof(i));
+		return i;
+	}
+
+	hed_assert_intern(key->mv_size == sizeof(z));
+	memcpy(&z, key->mv_data, sizeof(z));
+
+	return z;
+}
+
+/* Encode a native integer key of n bytes. */
+static void __hed_nonull(1)
+repo_scan_set_int(uint8_t * key, size_t n, uint64_t word)
+{
+	hed_assert_intern(key);
+
+	unsigned int i = (unsigned int)word;
+	size_t z = (size_t)word;
+
+	if (n == sizeof(i))
+		memcpy(key, &i, sizeof(i));
+	else {
+		hed_assert_intern(n == sizeof(z));
+		memcpy(key, &z, sizeof(z));
+	}
+}
+
+/*
+ * Split key space by interpolating keys between the first and last ones, then
+ * locating the entries these lead to. Ranges are only as even as keys are
+ * spread, which sequences and hashes are; ranges outnumbering workers make up
+ * for the rest.
+ */
+static int __hed_nonull(1, 2)
+repo_scan_split(struct repo_scan * scan, MDB_txn * txn, unsigned int want)
+{
+	hed_assert_intern(scan);
+	hed_assert_intern(txn);
+	hed_assert_intern(want > 1);
+
+	struct repo_many_ctx ctx = { .txn = txn, .dbi = scan->dbi };
+	uint8_t synth[HED_REPO_KEY_MAX];
+	MDB_cursor *cursor;
+	MDB_val first;
+	MDB_val last;
+	MDB_val idx;
+	MDB_val content;
+	size_t plen;
+	size_t n;
+	uint64_t lo;
+	uint64_t hi;
+	unsigned int r;
+	unsigned int nr;
 	int ret;
-	size_t len;
-	uint32_t *old;
-	uint32_t seq;
 
-	ret = hed_repo_get(repo, ".hed", (const uint8_t *)table, strlen(table),
-	                   (uint8_t **)&old, &len);
+	ret = mdb_cursor_open(txn, scan->dbi, &cursor);
 	if (ret)
-		return 0;
-
-	hed_assert_api(len == sizeof(seq));
-	seq = *old + 1;
+		return ret;
 
-	ret = hed_repo_update(repo , ".hed",
-	                      (const uint8_t *)table, strlen(table),
-	                      (uint8_t *)&seq, sizeof(seq));
+	ret = mdb_cursor_get(cursor, &first, &content, MDB_FIRST);
+	if (!ret)
+		ret = mdb_cursor_get(cursor, &last, &content, MDB_LAST);
 	if (ret)
-		return 0;
+		goto close;
+
+	if (scan->intkey) {
+		/* Integer keys must be interpolated and synthesized natively. */
+		hed_assert_intern(first.mv_size == last.mv_size);
+
+		plen = 0;
+		n = first.mv_size;
+		lo = repo_scan_int(&first);
+		hi = repo_scan_int(&last);
+	}
+	else {
+		for (plen = 0;
+		     (plen < first.mv_size) && (plen < last.mv_size) &&
+		     (((uint8_t *)first.mv_data)[plen] ==
+		      ((uint8_t *)last.mv_data)[plen]);
+		     plen++)
+			;
+
+		n = stroll_min(REPO_SCAN_WORD, sizeof(synth) - plen);
+		lo = repo_scan_word(&first, plen, n);
+		hi = repo_scan_word(&last, plen, n);
+	}
+	if (hi <= lo)
+		goto close;
+	if ((hi - lo) < want)
+		want = (unsigned int)(hi - lo);
+
+	scan->bound = malloc(want * sizeof(scan->bound[0]));
+	scan->keys = malloc(want * sizeof(synth));
+	if (!scan->bound || !scan->keys) {
+		ret = -ENOMEM;
+		goto close;
+	}
+
+	memcpy(synth, first.mv_data, plen);
+	for (r = 1, nr = 0; r < want; r++) {
+		uint64_t word = lo + (((hi - lo) / want) * r);
+		size_t b;
+
+		if (scan->intkey)
+			repo_scan_set_int(synth, n, word);
+		else
+			for (b = 0; b < n; b++)
+				synth[plen + b] =
+					(uint8_t)(word >> (8 * (n - 1 - b)));
+
+		idx.mv_data = synth;
+		idx.mv_size = plen + n;
+		ret = mdb_cursor_get(cursor, &idx, &content, MDB_SET_RANGE);
+		if (ret == MDB_NOTFOUND)
+			continue;
+		if (ret)
+			goto close;
+
+		scan->bound[nr].mv_data = &scan->keys[nr * sizeof(synth)];
+		scan->bound[nr].mv_size = idx.mv_size;
+		memcpy(scan->bound[nr].mv_data, idx.mv_data, idx.mv_size);
+		nr++;
+	}
 
-	return seq;
+	/* Custom key orders may not follow interpolation order. */
+	qsort_r(scan->bound, nr, sizeof(scan->bound[0]), repo_scan_cmp, &ctx);
+
+	for (r = 0, scan->range_nr = 1; r < nr; r++) {
+		const MDB_val *prev = (scan->range_nr > 1) ?
+		                      &scan->bound[scan->range_nr - 2] :
+		                      &first;
+
+		if (repo_scan_cmp(&scan->bound[r], prev, &ctx) <= 0)
+			continue;
+
+		scan->bound[scan->range_nr - 1] = scan->bound[r];
+		scan->range_nr++;
+	}
+
+	ret = 0;
+
+close:
+	mdb_cursor_close(cursor);
+
+	return (ret == MDB_NOTFOUND) ? 0 : ret;
 }
 
-struct hed_repo_iter *
-hed_repo_create_iter(struct hed_repo * repo,
-                     const char * table)
+static void __hed_nonull(1)
+repo_scan_fail(struct repo_scan * scan, int status)
 {
-	hed_assert_api(repo);
-	hed_assert_api(repo->env);
-	hed_assert_api(repo->txn);
-	hed_assert_api(table);
+	hed_assert_intern(scan);
+	hed_assert_intern(status);
 
-	struct hed_repo_iter *iter;
-	MDB_dbi dbi;
+	int none = 0;
 
-	if (mdb_dbi_open(repo->txn, table, 0, &dbi))
-		return NULL;
+	/* Keep the first failure. */
+	__atomic_compare_exchange_n(&scan->status, &none, status, false,
+	                            __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
 
-	iter = malloc(sizeof(*iter));
-	if (!iter)
+static int __hed_nonull(1, 2)
+repo_scan_range(const struct repo_scan_worker * worker,
+                MDB_cursor * cursor,
+                unsigned int range)
+{
+	hed_assert_intern(worker);
+	hed_assert_intern(cursor);
+
+	const struct repo_scan *scan = worker->scan;
+	bool bounded = (range + 1) < scan->range_nr;
+	MDB_cursor_op op = MDB_FIRST;
+	MDB_val idx;
+	MDB_val content;
+	int ret;
+
+	if (range) {
+		idx = scan->bound[range - 1];
+		op = MDB_SET_RANGE;
+	}
+
+	for (ret = mdb_cursor_get(cursor, &idx, &content, op);
+	     !ret;
+	     ret = mdb_cursor_get(cursor, &idx, &content, MDB_NEXT)) {
+		if (bounded &&
+		    (mdb_cmp(worker->txn, scan->dbi, &idx,
+		             &scan->bound[range]) >= 0))
+			return 0;
+
+		if (__atomic_load_n(&scan->status, __ATOMIC_RELAXED))
+			return 0;
+
+		ret = scan->fn(worker->id,
+		               idx.mv_data,
+		               idx.mv_size,
+		               content.mv_data,
+		               content.mv_size,
+		               scan->data);
+		if (ret)
+			return ret;
+	}
+
+	return (ret == MDB_NOTFOUND) ? 0 : ret;
+}
+
+static void * __hed_nonull(1)
+repo_scan_run(void * arg)
+{
+	hed_assert_intern(arg);
+
+	struct repo_scan_worker *worker = arg;
+	struct repo_scan *scan = worker->scan;
+	MDB_cursor *cursor;
+	int ret;
+
+	ret = mdb_cursor_open(worker->txn, scan->dbi, &cursor);
+	if (ret) {
+		repo_scan_fail(scan, ret);
 		return NULL;
+	}
 
-	iter->repo = repo;
-	if (mdb_cursor_open(repo->txn, dbi, &iter->cursor))
-		goto error;
+	while (!__atomic_load_n(&scan->status, __ATOMIC_RELAXED)) {
+		unsigned int range = __atomic_fetch_add(&scan->next, 1U,
+		                                        __ATOMIC_RELAXED);
 
-	if (mdb_cursor_get(iter->cursor, NULL, NULL, MDB_FIRST))
-		goto error;
+		if (range >= scan->range_nr)
+			break;
+
+		ret = repo_scan_range(worker, cursor, range);
+		if (ret) {
+			repo_scan_fail(scan, ret);
+			break;
+		}
+	}
+
+	mdb_cursor_close(cursor);
 
-	return iter;
-error:
-	free(iter);
 	return NULL;
 }
 
-void
-hed_repo_destroy_iter(struct hed_repo_iter *iter)
+static void __hed_nonull(1)
+repo_scan_end_txns(struct repo_scan_worker * workers, unsigned int nr)
 {
-	hed_assert_api(iter);
-	hed_assert_api(iter->cursor);
+	hed_assert_intern(workers);
 
-	mdb_cursor_close(iter->cursor);
-	free(iter);
+	while (nr--)
+		mdb_txn_abort(workers[nr].txn);
+}
+
+/* Start read transactions of all workers on the same snapshot. */
+static int __hed_nonull(1, 2)
+repo_scan_begin_txns(struct hed_repo * repo,
+                     struct repo_scan_worker * workers,
+                     unsigned int nr)
+{
+	hed_assert_intern(repo);
+	hed_assert_intern(workers);
+	hed_assert_intern(nr);
+
+	unsigned int attempt;
+	unsigned int w;
+	int ret;
+
+	for (attempt = 0; attempt < REPO_SCAN_RETRY; attempt++) {
+		for (w = 0; w < nr; w++) {
+			ret = mdb_txn_begin(repo->env, NULL, MDB_RDONLY,
+			                    &workers[w].txn);
+			if (ret) {
+				repo_scan_end_txns(workers, w);
+				return ret;
+			}
+
+			if (mdb_txn_id(workers[w].txn) !=
+			    mdb_txn_id(workers[0].txn)) {
+				/* A write committed meanwhile. */
+				repo_scan_end_txns(workers, w + 1);
+				break;
+			}
+		}
+
+		if (w == nr)
+			return 0;
+	}
+
+	return -EAGAIN;
 }
 
 int
-hed_repo_step(struct hed_repo_iter * iter,
-              uint8_t * * const key,
-              size_t  * klen,
-              uint8_t * * const value,
-              size_t * vlen)
+hed_repo_scan(struct hed_repo * repo,
+              unsigned int tbl,
+              unsigned int nr,
+              hed_repo_scan_fn * fn,
+              void * data)
 {
-	hed_assert_api(iter);
-	hed_assert_api(iter->cursor);
-	hed_assert_api(!!key | !!value);
-	hed_assert_api(!(!!key ^ !!klen));
-	hed_assert_api(!(!!value ^ !!vlen));
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(tbl <= HED_REPO_META_TBL(repo));
+	hed_assert_api(nr);
+	hed_assert_api(fn);
 
-	MDB_val idx;
-	MDB_val content;
+	struct repo_scan scan = {
+		.dbi      = repo->dbi[tbl],
+		.intkey   = hed_repo_tbl_intkey(repo, tbl),
+		.bound    = NULL,
+		.keys     = NULL,
+		.range_nr = 1,
+		.next     = 0,
+		.status   = 0,
+		.fn       = fn,
+		.data     = data
+	};
+	struct repo_scan_worker *workers;
+	MDB_stat stat;
+	unsigned int want;
+	unsigned int run;
+	unsigned int w;
 	int ret;
 
-	ret = mdb_cursor_get(iter->cursor, &idx, &content, MDB_GET_CURRENT);
+	workers = malloc(nr * sizeof(workers[0]));
+	if (!workers)
+		return -ENOMEM;
+
+	for (w = 0; w < nr; w++) {
+		workers[w].scan = &scan;
+		workers[w].id = w;
+	}
+
+	/* Read transactions must not see the map resized under their feet. */
+	pthread_mutex_lock(&repo->snap_lock);
+	repo->snap_nr++;
+	pthread_mutex_unlock(&repo->snap_lock);
+
+	ret = repo_scan_begin_txns(repo, workers, nr);
 	if (ret)
-		return -EINVAL;
+		goto put;
 
-	if (key) {
-		*key  = idx.mv_data;
-		*klen = idx.mv_size;
+	ret = mdb_stat(workers[0].txn, scan.dbi, &stat);
+	if (ret)
+		goto end;
+
+	want = (unsigned int)stroll_min(stat.ms_entries / REPO_SCAN_MIN,
+	                                (size_t)nr * REPO_SCAN_SPLIT);
+	if (want > 1) {
+		ret = repo_scan_split(&scan, workers[0].txn, want);
+		if (ret)
+			goto free;
 	}
 
-	if (value) {
-		*value = content.mv_data;
-		*vlen  = content.mv_size;
+	/* No point in running more workers than there are ranges. */
+	run = stroll_min(nr, scan.range_nr);
+	for (w = 1; w < run; w++) {
+		ret = -pthread_create(&workers[w].thread, NULL, repo_scan_run,
+		                      &workers[w]);
+		if (ret) {
+			repo_scan_fail(&scan, ret);
+			break;
+		}
 	}
 
-	ret = mdb_cursor_get(iter->cursor, NULL, NULL, MDB_NEXT);
-	if (ret == MDB_NOTFOUND)
-		return 0;
+	repo_scan_run(&workers[0]);
 
-	if (ret)
-		return -EINVAL;
+	while (--w)
+		pthread_join(workers[w].thread, NULL);
 
-	return EAGAIN;
+	ret = scan.status;
+
+free:
+	free(scan.bound);
+	free(scan.keys);
+end:
+	repo_scan_end_txns(workers, nr);
+put:
+	pthread_mutex_lock(&repo->snap_lock);
+	repo->snap_nr--;
+	pthread_mutex_unlock(&repo->snap_lock);
+
+	free(workers);
+
+	return ret;
 }
@@ -106,6 +106,293 @@ hed_srv_close_sigchan(struct hed_server *srv)
 	usig_close_fd(srv->sig_fd);
 }
 
+static void __hed_nonull(1)
+hed_srv_group_complete(struct hed_srv_group *group, int status)
+{
+	hed_assert_intern(group);
+
+	unsigned int i;
+
+	for (i = 0; i < group->nr; i++)
+		group->pending[i].fn(status, group->pending[i].ctx);
+
+	group->nr = 0;
+}
+
+static void __hed_nonull(1)
+hed_srv_group_expire(struct etux_timer *timer)
+{
+	hed_assert_intern(timer);
+
+	struct hed_server *srv;
+
+	srv = containerof(timer, struct hed_server, group.timer);
+	hed_assert_intern(srv->group.repo);
+
+	hed_srv_repo_flush(srv);
+}
+
+void
+hed_srv_attach_repo(struct hed_server *srv,
+                    struct hed_repo   *repo,
+                    int                window)
+{
+	hed_assert_api(srv);
+	hed_assert_api(repo);
+	hed_assert_api(repo->env);
+	hed_assert_api(window >= 0);
+	hed_assert_api(!srv->group.repo);
+
+	srv->group.repo = repo;
+	srv->group.window = window;
+	srv->group.nr = 0;
+	srv->group.saved = false;
+	etux_timer_init(&srv->group.timer, hed_srv_group_expire);
+}
+
+int
+hed_srv_repo_start(struct hed_server *srv)
+{
+	hed_assert_api(srv);
+	hed_assert_api(srv->group.repo);
+	hed_assert_api(!srv->group.saved);
+
+	struct hed_srv_group *group = &srv->group;
+	int ret;
+
+	if (!group->repo->txn) {
+		ret = hed_repo_start(group->repo);
+		if (ret)
+			return ret;
+	}
+
+	ret = hed_repo_save_begin(group->repo, &group->save);
+	if (ret)
+		/* Without savepoints, aborting drops the whole group. */
+		return (ret == -ENOTSUP) ? 0 : ret;
+
+	group->saved = true;
+
+	return 0;
+}
+
+int
+hed_srv_repo_commit(struct hed_server *srv,
+                    hed_srv_commit_fn *fn,
+                    void              *ctx)
+{
+	hed_assert_api(srv);
+	hed_assert_api(srv->group.repo);
+	hed_assert_api(srv->group.repo->txn);
+	hed_assert_api(fn);
+
+	struct hed_srv_group *group = &srv->group;
+	int ret;
+
+	if (group->saved) {
+		group->saved = false;
+		ret = hed_repo_save_commit(group->repo);
+		if (ret)
+			return ret;
+	}
+
+	if (!group->nr && group->window)
+		etux_timer_arm_msec(&group->timer, group->window);
+
+	group->pending[group->nr].fn = fn;
+	group->pending[group->nr].ctx = ctx;
+	group->nr++;
+
+	if (group->nr == CONFIG_HED_SRV_GROUP_NR)
+		/*
+		 * Group is full: commit it, the next request opens a new one.
+		 * Completions, this one included, are given the status.
+		 */
+		hed_srv_repo_flush(srv);
+
+	return 0;
+}
+
+void
+hed_srv_repo_abort(struct hed_server *srv)
+{
+	hed_assert_api(srv);
+	hed_assert_api(srv->group.repo);
+
+	struct hed_srv_group *group = &srv->group;
+
+	if (group->saved) {
+		group->saved = false;
+		hed_repo_save_abort(group->repo);
+		if (group->nr && group->repo->txn)
+			/* Only this request loses its modifications. */
+			return;
+	}
+
+	/* Every request of the group loses its modifications. */
+	if (group->window)
+		etux_timer_cancel(&group->timer);
+	if (group->repo->txn || group->repo->log.lost)
+		hed_repo_abort(group->repo);
+	hed_srv_group_complete(group, -ECANCELED);
+}
+
+int
+hed_srv_repo_flush(struct hed_server *srv)
+{
+	hed_assert_api(srv);
+	hed_assert_api(srv->group.repo);
+
+	struct hed_srv_group *group = &srv->group;
+	int ret = 0;
+
+	if (group->window)
+		etux_timer_cancel(&group->timer);
+	if (group->repo->txn)
+		ret = hed_repo_commit(group->repo);
+	hed_srv_group_complete(group, ret);
+
+	return ret;
+}
+
+static int __hed_nonull(1, 3)
+hed_srv_dispatch_feed(struct upoll_worker * work,
+                      uint32_t              state __unused,
+                      const struct upoll *  poll __unused)
+{
+	hed_assert_intern(work);
+	hed_assert_intern(state & EPOLLIN);
+	hed_assert_intern(poll);
+
+	struct hed_server *srv;
+
+	srv = containerof(work, struct hed_server, feed.worker);
+	hed_assert_intern(srv->group.repo);
+	hed_assert_intern(srv->feed.fn);
+
+	hed_repo_feed_clear(srv->group.repo);
+
+	return srv->feed.fn(srv->feed.ctx);
+}
+
+int
+hed_srv_watch_feed(struct hed_server *srv,
+                   hed_srv_feed_fn   *fn,
+                   void              *ctx)
+{
+	hed_assert_api(srv);
+	hed_assert_api(srv->group.repo);
+	hed_assert_api(srv->group.repo->feed.ring);
+	hed_assert_api(!srv->feed.fn);
+	hed_assert_api(fn);
+
+	int ret;
+
+	srv->feed.worker.dispatch = hed_srv_dispatch_feed;
+	ret = upoll_register(&srv->poll,
+	                     hed_repo_feed_fd(srv->group.repo),
+	                     EPOLLIN,
+	                     &srv->feed.worker);
+	if (ret)
+		return ret;
+
+	srv->feed.fn = fn;
+	srv->feed.ctx = ctx;
+
+	return 0;
+}
+
+void
+hed_srv_unwatch_feed(struct hed_server *srv)
+{
+	hed_assert_api(srv);
+	hed_assert_api(srv->group.repo);
+	hed_assert_api(srv->feed.fn);
+
+	upoll_unregister(&srv->poll, hed_repo_feed_fd(srv->group.repo));
+	srv->feed.fn = NULL;
+}
+
+/*
+ * Delay before sweeping the next batch of a backlog. Timers due right away
+ * make hed_srv_process() skip dispatching: leave it a chance to serve requests
+ * between batches.
+ */
+#define HED_SRV_SWEEP_YIELD_MSEC 1
+
+static void
+hed_srv_sweep_complete(int status __unused, void * ctx __unused)
+{
+}
+
+static void __hed_nonull(1)
+hed_srv_sweep_expire(struct etux_timer *timer)
+{
+	hed_assert_intern(timer);
+
+	struct hed_server *srv;
+	struct timespec now;
+	ssize_t nr;
+	int ret;
+
+	srv = containerof(timer, struct hed_server, sweep.timer);
+	hed_assert_intern(srv->group.repo);
+	hed_assert_intern(srv->sweep.period > 0);
+
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	ret = hed_srv_repo_start(srv);
+	if (ret)
+		goto arm;
+
+	nr = hed_repo_expire(srv->group.repo, &now, CONFIG_HED_SRV_SWEEP_NR);
+	if (nr < 0) {
+		hed_srv_repo_abort(srv);
+		goto arm;
+	}
+
+	ret = hed_srv_repo_commit(srv, hed_srv_sweep_complete, NULL);
+	if (ret) {
+		hed_srv_repo_abort(srv);
+		goto arm;
+	}
+
+	/* Timers run outside of dispatching, which flushes immediate groups. */
+	if (!srv->group.window)
+		hed_srv_repo_flush(srv);
+
+	if (nr == CONFIG_HED_SRV_SWEEP_NR) {
+		etux_timer_arm_msec(&srv->sweep.timer,
+		                    HED_SRV_SWEEP_YIELD_MSEC);
+		return;
+	}
+
+arm:
+	etux_timer_arm_msec(&srv->sweep.timer, srv->sweep.period);
+}
+
+void
+hed_srv_start_sweep(struct hed_server *srv, int period)
+{
+	hed_assert_api(srv);
+	hed_assert_api(srv->group.repo);
+	hed_assert_api(period > 0);
+	hed_assert_api(!srv->sweep.period);
+
+	srv->sweep.period = period;
+	etux_timer_init(&srv->sweep.timer, hed_srv_sweep_expire);
+	etux_timer_arm_msec(&srv->sweep.timer, period);
+}
+
+void
+hed_srv_stop_sweep(struct hed_server *srv)
+{
+	hed_assert_api(srv);
+	hed_assert_api(srv->sweep.period);
+
+	etux_timer_cancel(&srv->sweep.timer);
+	srv->sweep.period = 0;
+}
 
 int
 hed_srv_init(struct hed_server                 *srv,
@@ -124,12 +411,15 @@ hed_srv_init(struct hed_server                 *srv,
 	galv_unix_adopt_config(&unix_conf, SOCK_STREAM, SOCK_CLOEXEC,
 	                       path, CONFIG_HED_CONN_NR);
 	galv_repo_init(&srv->repo, CONFIG_HED_CONN_NR);
+	srv->group.repo = NULL;
+	srv->feed.fn = NULL;
+	srv->sweep.period = 0;
 
 	ret = galv_unix_adopt_open(&srv->adopt, GALV_GATE_DUMMY, &unix_conf);
 	if (ret)
 		goto fini;
 
-	ret = upoll_open(&srv->poll, CONFIG_HED_CONN_NR + 1);
+	ret = upoll_open(&srv->poll, CONFIG_HED_CONN_NR + 2);
 	if (ret)
 		goto close_adopt;
 
@@ -173,13 +463,16 @@ hed_srv_conn_init(struct hed_server                 *srv,
 	int ret;
 
 	galv_repo_init(&srv->repo, CONFIG_HED_CONN_NR);
+	srv->group.repo = NULL;
+	srv->feed.fn = NULL;
+	srv->sweep.period = 0;
 
 	ret = galv_fd_adopt_open(&srv->adopt,
 	                         GALV_GATE_DUMMY, fd);
 	if (ret)
 		goto fini;
 
-	ret = upoll_open(&srv->poll, CONFIG_HED_CONN_NR + 1);
+	ret = upoll_open(&srv->poll, CONFIG_HED_CONN_NR + 2);
 	if (ret)
 		goto close_adopt;
 
@@ -225,7 +518,13 @@ hed_srv_process(struct hed_server *srv)
 	if (ret <= 0)
 		return ret;
 
-	return upoll_dispatch(&srv->poll, (unsigned int)ret);
+	ret = upoll_dispatch(&srv->poll, (unsigned int)ret);
+
+	/* Commit requests dispatched during this iteration all at once. */
+	if (srv->group.repo && !srv->group.window)
+		hed_srv_repo_flush(srv);
+
+	return ret;
 }
 
 int
@@ -279,6 +578,12 @@ hed_srv_fini(struct hed_server *srv)
 {
 	hed_assert_api(srv);
 
+	if (srv->sweep.period)
+		hed_srv_stop_sweep(srv);
+	if (srv->group.repo)
+		hed_srv_repo_flush(srv);
+	if (srv->feed.fn)
+		hed_srv_unwatch_feed(srv);
 	hed_srv_close_sigchan(srv);
 	galv_rpc_close_accept(&srv->accept, &srv->poll);
 	upoll_close(&srv->poll);